@@ -0,0 +1,447 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <format>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "chat_server.hpp"
+#include "client_store.hpp"
+#include "compression.hpp"
+#include "fanout_pool.hpp"
+#include "message_template.hpp"
+#include "mpsc_queue.hpp"
+#include "protocol.hpp"
+#include "transport.hpp"
+
+// Microbenchmarks for the steps of the chat pipeline. Servers run over
+// MemoryTransport, which only counts output, so the numbers are the
+// server's own CPU cost per call with no system call in the way; only
+// BM_FanoutSocketpairs pays for real sends. Build with
+// -DCMAKE_BUILD_TYPE=Release before comparing runs.
+
+struct ChatServerBench {
+    template<typename Server>
+    static auto find_client(Server& server, int socket) {
+        return server.find_client(socket);
+    }
+
+    template<typename Server>
+    static bool nickname_exists(Server& server, const Nickname& nickname) {
+        return server.nickname_exists(nickname);
+    }
+
+    template<typename Server>
+    static void send_welcome(Server& server, int socket) {
+        server.send_welcome(socket, CLIENT_REGISTERED);
+    }
+
+    template<typename Server>
+    static void broadcast(Server& server, const ChatEvent& event) {
+        server.broadcast(event);
+    }
+};
+
+template<typename Container>
+using MemoryServer = ChatServer<int, Container, MemoryTransport>;
+
+using ListContainer = std::list<Client<int>>;
+using VectorContainer = std::vector<Client<int>>;
+
+// A server with `clients` registered users, built once per configuration
+// and reused by every benchmark that asks for it.
+template<typename Container>
+struct Rig {
+    MemoryTransport net{false};
+    std::unique_ptr<MemoryServer<Container>> server;
+    std::vector<int> sockets;
+
+    Rig(size_t clients, size_t workers) {
+        ServerOptions options;
+        options.quiet = true;
+        options.fanout_workers = workers;
+        options.fanout_threshold = 1;
+        server = std::make_unique<MemoryServer<Container>>(options, net);
+        for (size_t i = 0; i < clients; ++i) {
+            sockets.push_back(net.connect(options.port));
+        }
+        settle();
+        for (size_t i = 0; i < clients; ++i) {
+            net.deliver(sockets[i], std::format("user{}\r\n", i));
+        }
+        settle();
+    }
+
+    void settle() {
+        while (server->run_once() > 0) {
+        }
+    }
+
+    static Rig& get(size_t clients, size_t workers = 0) {
+        static std::map<std::pair<size_t, size_t>, std::unique_ptr<Rig>> rigs;
+        auto& rig = rigs[{clients, workers}];
+        if (!rig) {
+            rig = std::make_unique<Rig>(clients, workers);
+        }
+        return *rig;
+    }
+};
+
+template<typename Container>
+static void BM_FindClient(benchmark::State& state) {
+    auto& rig = Rig<Container>::get(static_cast<size_t>(state.range(0)));
+    size_t next = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ChatServerBench::find_client(*rig.server, rig.sockets[next]));
+        next = next + 1 == rig.sockets.size() ? 0 : next + 1;
+    }
+    state.SetComplexityN(state.range(0));
+}
+
+// A name nobody holds: the miss path every new registration takes.
+template<typename Container>
+static void BM_NicknameExists(benchmark::State& state) {
+    auto& rig = Rig<Container>::get(static_cast<size_t>(state.range(0)));
+    Nickname absent{"nobody"};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ChatServerBench::nickname_exists(*rig.server, absent));
+    }
+    state.SetComplexityN(state.range(0));
+}
+
+template<typename Container>
+static void BM_SendWelcome(benchmark::State& state) {
+    auto& rig = Rig<Container>::get(static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        ChatServerBench::send_welcome(*rig.server, rig.sockets.front());
+    }
+}
+
+// One chat line rendered and sent to every other client.
+template<typename Container>
+static void BM_Broadcast(benchmark::State& state) {
+    auto& rig = Rig<Container>::get(static_cast<size_t>(state.range(0)));
+    ChatEvent event{EventType::Chat, rig.sockets.front(), "user0", "hello everyone, how is it going?"};
+    for (auto _ : state) {
+        ChatServerBench::broadcast(*rig.server, event);
+    }
+    state.SetItemsProcessed(state.iterations() * (state.range(0) - 1));
+    state.SetComplexityN(state.range(0));
+}
+
+// The whole path of a chat line: read, line split, lookup and broadcast.
+template<typename Container>
+static void BM_ChatLine(benchmark::State& state) {
+    auto& rig = Rig<Container>::get(static_cast<size_t>(state.range(0)));
+    size_t next = 0;
+    for (auto _ : state) {
+        rig.net.deliver(rig.sockets[next], "hello everyone, how is it going?\r\n");
+        rig.settle();
+        next = next + 1 == rig.sockets.size() ? 0 : next + 1;
+    }
+    state.SetItemsProcessed(state.iterations() * (state.range(0) - 1));
+}
+
+// A guest connects, registers and leaves, announcing both to the room.
+template<typename Container>
+static void BM_Registration(benchmark::State& state) {
+    auto& rig = Rig<Container>::get(static_cast<size_t>(state.range(0)));
+    ServerOptions defaults;
+    for (auto _ : state) {
+        int guest = rig.net.connect(defaults.port);
+        rig.settle();
+        rig.net.deliver(guest, "guest\r\n");
+        rig.settle();
+        rig.net.hang_up(guest);
+        rig.settle();
+    }
+}
+
+// Serial fan-out against the worker pool, to find where workers start to pay.
+static void BM_FanoutWorkers(benchmark::State& state) {
+    auto& rig = Rig<ClientStore<int>>::get(static_cast<size_t>(state.range(0)), static_cast<size_t>(state.range(1)));
+    ChatEvent event{EventType::Chat, rig.sockets.front(), "user0", "hello everyone, how is it going?"};
+    for (auto _ : state) {
+        ChatServerBench::broadcast(*rig.server, event);
+    }
+    state.SetItemsProcessed(state.iterations() * (state.range(0) - 1));
+}
+
+// The same split over socketpairs with a real send per recipient, which is
+// the cost workers are meant to spread. The receiving ends are drained
+// outside the timing before their buffers fill.
+static void BM_FanoutSocketpairs(benchmark::State& state) {
+    auto count = static_cast<size_t>(state.range(0));
+    std::vector<int> senders;
+    std::vector<int> receivers;
+    for (size_t i = 0; i < count; ++i) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, pair) < 0) {
+            state.SkipWithError("socketpair failed; raise the descriptor limit");
+            break;
+        }
+        senders.push_back(pair[0]);
+        receivers.push_back(pair[1]);
+    }
+    auto close_all = [&] {
+        for (int fd : senders) close(fd);
+        for (int fd : receivers) close(fd);
+    };
+    if (senders.size() != count) {
+        close_all();
+        return;
+    }
+
+    std::string line = CHAT_MESSAGE.render(std::string_view{"user0"}, std::string_view{"hello everyone, how is it going?"});
+    FanoutPool pool(static_cast<size_t>(state.range(1)));
+    auto fan_out = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            send(senders[i], line.data(), line.size(), MSG_NOSIGNAL);
+        }
+    };
+
+    constexpr size_t drain_every = 1024;
+    char sink[64 * 1024];
+    size_t unread = 0;
+    for (auto _ : state) {
+        pool.run(count, fan_out);
+        if (++unread == drain_every) {
+            state.PauseTiming();
+            for (int fd : receivers) {
+                while (read(fd, sink, sizeof(sink)) > 0) {
+                }
+            }
+            unread = 0;
+            state.ResumeTiming();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    close_all();
+}
+
+// Container matrix: the same operations on each container alone, from 100
+// to 100,000 clients, with descriptors numbered densely like the kernel's.
+
+constexpr int FIRST_CLIENT_FD = 8;
+
+template<typename Container>
+static void fill(Container& clients, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        clients.emplace_back(FIRST_CLIENT_FD + static_cast<int>(i), Nickname{std::format("user{}", i)});
+    }
+    for (auto&& client : clients) {
+        client.flags = CLIENT_REGISTERED;
+    }
+}
+
+static std::vector<int> shuffled_sockets(size_t count) {
+    std::vector<int> sockets(count);
+    std::iota(sockets.begin(), sockets.end(), FIRST_CLIENT_FD);
+    std::shuffle(sockets.begin(), sockets.end(), std::mt19937{42});
+    return sockets;
+}
+
+template<typename Container>
+static void BM_ContainerJoin(benchmark::State& state) {
+    auto count = static_cast<size_t>(state.range(0));
+    for (auto _ : state) {
+        Container clients;
+        fill(clients, count);
+        benchmark::DoNotOptimize(clients);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Everyone leaves in random order.
+template<typename Container>
+static void BM_ContainerLeave(benchmark::State& state) {
+    auto count = static_cast<size_t>(state.range(0));
+    auto order = shuffled_sockets(count);
+    for (auto _ : state) {
+        state.PauseTiming();
+        Container clients;
+        fill(clients, count);
+        state.ResumeTiming();
+        for (int socket : order) {
+            erase_client(clients, socket);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template<typename Container>
+static void BM_ContainerLookup(benchmark::State& state) {
+    auto count = static_cast<size_t>(state.range(0));
+    auto order = shuffled_sockets(count);
+    Container clients;
+    fill(clients, count);
+    size_t next = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(find_client_in(clients, order[next]));
+        next = next + 1 == order.size() ? 0 : next + 1;
+    }
+}
+
+// The walk a broadcast makes: every socket and its flags, through the
+// dense columns where the container has them.
+template<typename Container>
+static void BM_ContainerBroadcast(benchmark::State& state) {
+    Container clients;
+    fill(clients, static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        std::int64_t sum = 0;
+        if constexpr (requires { clients.sockets(); clients.flags(); }) {
+            auto sockets = clients.sockets();
+            auto flags = clients.flags();
+            for (size_t i = 0; i < sockets.size(); ++i) {
+                if (in_lobby(flags[i])) sum += sockets[i];
+            }
+        } else {
+            for (const auto& client : clients) {
+                if (in_lobby(client.flags)) sum += client.socket;
+            }
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_RenderChatTemplate(benchmark::State& state) {
+    std::string out;
+    for (auto _ : state) {
+        out.clear();
+        CHAT_MESSAGE.append_to(out, std::string_view{"alice"}, std::string_view{"hello everyone, how is it going?"});
+        benchmark::DoNotOptimize(out.data());
+    }
+}
+
+static void BM_FormatChatLine(benchmark::State& state) {
+    std::string out;
+    for (auto _ : state) {
+        out.clear();
+        std::format_to(std::back_inserter(out), "💬 {}: {}\r\n", "alice", "hello everyone, how is it going?");
+        benchmark::DoNotOptimize(out.data());
+    }
+}
+
+static void BM_AppendEventFrame(benchmark::State& state) {
+    std::string out;
+    for (auto _ : state) {
+        out.clear();
+        append_event_frame(out, FrameType::Chat, 7, "alice", "hello everyone, how is it going?");
+        benchmark::DoNotOptimize(out.data());
+    }
+}
+
+// Splits a read holding 64 binary chat frames.
+static void BM_ParseFrames(benchmark::State& state) {
+    std::string input;
+    for (int i = 0; i < 64; ++i) {
+        append_frame(input, FrameType::Chat, 0, "hello everyone, how is it going?");
+    }
+    for (auto _ : state) {
+        std::string_view rest = input;
+        Frame frame;
+        size_t consumed = 0;
+        while (parse_frame(rest, frame, consumed) == ParseStatus::Complete) {
+            benchmark::DoNotOptimize(frame.payload.data());
+            rest.remove_prefix(consumed);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * 64);
+}
+
+static void BM_DeflateLine(benchmark::State& state) {
+    if (!DeflateEncoder::available) {
+        state.SkipWithError("built without zlib");
+        return;
+    }
+    DeflateEncoder encoder;
+    std::string line = CHAT_MESSAGE.render(std::string_view{"alice"}, std::string_view{"hello everyone, how is it going?"});
+    std::string out;
+    for (auto _ : state) {
+        out.clear();
+        encoder.compress_into(out, line);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<std::int64_t>(line.size()));
+}
+
+static void BM_MpscPushPop(benchmark::State& state) {
+    MpscQueue<std::uint64_t> queue(MAILBOX_CAPACITY);
+    std::uint64_t value = 0;
+    for (auto _ : state) {
+        queue.try_push(value++);
+        benchmark::DoNotOptimize(queue.try_pop());
+    }
+}
+
+// Producer threads push into one queue while this thread drains it.
+static void BM_MpscProducers(benchmark::State& state) {
+    constexpr std::uint64_t per_producer = 100'000;
+    auto producers = static_cast<size_t>(state.range(0));
+    for (auto _ : state) {
+        MpscQueue<std::uint64_t> queue(MAILBOX_CAPACITY);
+        std::vector<std::jthread> threads;
+        for (size_t p = 0; p < producers; ++p) {
+            threads.emplace_back([&queue] {
+                for (std::uint64_t i = 0; i < per_producer; ++i) {
+                    while (!queue.try_push(i)) {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+        std::uint64_t received = 0;
+        while (received < producers * per_producer) {
+            if (queue.try_pop()) {
+                ++received;
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(producers * per_producer));
+}
+
+#define CLIENT_COUNTS RangeMultiplier(10)->Range(10, 10'000)
+#define MATRIX_COUNTS RangeMultiplier(10)->Range(100, 100'000)
+
+// Registers one benchmark template for every container.
+#define EACH_CONTAINER(bench, ...)                                    \
+    BENCHMARK_TEMPLATE(bench, ClientStore<int>)->__VA_ARGS__;         \
+    BENCHMARK_TEMPLATE(bench, FdClientStore<int>)->__VA_ARGS__;       \
+    BENCHMARK_TEMPLATE(bench, HashedClientStore<int>)->__VA_ARGS__;   \
+    BENCHMARK_TEMPLATE(bench, VectorContainer)->__VA_ARGS__;          \
+    BENCHMARK_TEMPLATE(bench, ListContainer)->__VA_ARGS__
+
+EACH_CONTAINER(BM_FindClient, CLIENT_COUNTS->Complexity());
+EACH_CONTAINER(BM_NicknameExists, CLIENT_COUNTS->Complexity());
+EACH_CONTAINER(BM_SendWelcome, CLIENT_COUNTS);
+EACH_CONTAINER(BM_Broadcast, CLIENT_COUNTS->Complexity());
+EACH_CONTAINER(BM_ChatLine, CLIENT_COUNTS);
+EACH_CONTAINER(BM_Registration, CLIENT_COUNTS);
+EACH_CONTAINER(BM_ContainerJoin, MATRIX_COUNTS);
+EACH_CONTAINER(BM_ContainerLeave, MATRIX_COUNTS);
+EACH_CONTAINER(BM_ContainerLookup, MATRIX_COUNTS);
+EACH_CONTAINER(BM_ContainerBroadcast, MATRIX_COUNTS);
+BENCHMARK(BM_FanoutWorkers)->ArgsProduct({{100, 1'000, 10'000}, {0, 2, 4}})->UseRealTime();
+BENCHMARK(BM_FanoutSocketpairs)->ArgsProduct({{64, 256, 1'024, 4'096}, {0, 1, 2, 4}})->UseRealTime();
+BENCHMARK(BM_RenderChatTemplate);
+BENCHMARK(BM_FormatChatLine);
+BENCHMARK(BM_AppendEventFrame);
+BENCHMARK(BM_ParseFrames);
+BENCHMARK(BM_DeflateLine);
+BENCHMARK(BM_MpscPushPop);
+BENCHMARK(BM_MpscProducers)->Arg(1)->Arg(2)->Arg(4)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
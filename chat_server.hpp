@@ -0,0 +1,2371 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <list>
+#include <print>
+#include <format>
+#include <optional>
+#include <concepts>
+#include <ranges>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <vector>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+#include <cstdint>
+#include <iterator>
+#include <span>
+#include <memory>
+#include <chrono>
+#include <cstdlib>
+#include <climits>
+#include <sys/uio.h>
+#include <linux/tcp.h>
+#include <linux/errqueue.h>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <array>
+#include <charconv>
+#include <bit>
+
+#include "client_store.hpp"
+#include "compression.hpp"
+#include "config.hpp"
+#include "fanout_pool.hpp"
+#include "federation.hpp"
+#include "handoff.hpp"
+#include "mpsc_queue.hpp"
+#include "presence.hpp"
+#include "protocol.hpp"
+#include "ring.hpp"
+#include "tls.hpp"
+#include "transport.hpp"
+#include "websocket.hpp"
+
+constexpr size_t MAILBOX_CAPACITY = 4096;
+// Names shown in the welcome; the rest are reachable through /who.
+constexpr size_t WELCOME_PREVIEW = 10;
+constexpr size_t WHO_PAGE_SIZE = 50;
+constexpr std::uint64_t REGISTRATION_REPORT_INTERVAL = 1000;
+// How often departed sockets are checked for zerocopy completions, and how
+// long they may wait for them before the connection is reset.
+constexpr std::chrono::milliseconds ZEROCOPY_REAP_INTERVAL{10};
+constexpr std::chrono::seconds ZEROCOPY_GRACE{5};
+
+static_assert(MAX_NICKNAME_LENGTH <= HANDOFF_NICKNAME_MAX);
+
+// Holds TCP_CORK for the lifetime of a multi-part write; uncorking flushes.
+template<Transport Net>
+class CorkGuard {
+public:
+    CorkGuard(Net& net, int socket, bool enabled) : transport(net), fd(enabled ? socket : -1) {
+        set(1);
+    }
+
+    CorkGuard(const CorkGuard&) = delete;
+    CorkGuard& operator=(const CorkGuard&) = delete;
+
+    ~CorkGuard() {
+        set(0);
+    }
+
+private:
+    void set(int value) {
+        if (fd >= 0) {
+            transport.setsockopt(fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+        }
+    }
+
+    Net& transport;
+    int fd;
+};
+
+constexpr std::uint8_t CLIENT_REGISTERED = 1 << 0;
+constexpr std::uint8_t CLIENT_BINARY = 1 << 1;
+constexpr std::uint8_t CLIENT_DEFLATE = 1 << 2;
+// Accepted on the WebSocket or TLS listener; CLIENT_UPGRADED once that
+// protocol's handshake is done.
+constexpr std::uint8_t CLIENT_WEBSOCKET = 1 << 3;
+constexpr std::uint8_t CLIENT_UPGRADED = 1 << 4;
+constexpr std::uint8_t CLIENT_TLS = 1 << 5;
+// In a named room rather than the lobby.
+constexpr std::uint8_t CLIENT_IN_ROOM = 1 << 6;
+
+constexpr bool in_lobby(std::uint8_t flags) {
+    return (flags & (CLIENT_REGISTERED | CLIENT_IN_ROOM)) == CLIENT_REGISTERED;
+}
+
+constexpr Encoding encoding_of(std::uint8_t flags) {
+    if (flags & CLIENT_BINARY) return Encoding::Binary;
+    if (flags & CLIENT_WEBSOCKET) return Encoding::WebSocket;
+    if (flags & CLIENT_DEFLATE) return Encoding::Deflate;
+    return Encoding::Text;
+}
+
+// Encoded broadcast handed to the event loop from another thread.
+template<SocketType SocketT = int>
+struct Delivery {
+    std::shared_ptr<const std::string> payload;
+    SocketT exclude = -1;
+};
+
+// Lines collected during one batching window, rendered once per encoding.
+// Each line remembers its sender so the flush can leave it out of that
+// sender's copy.
+template<SocketType SocketT = int>
+struct Batch {
+    struct Line {
+        SocketT sender;
+        std::array<size_t, ENCODING_COUNT> offset;
+        std::array<size_t, ENCODING_COUNT> length;
+    };
+
+    std::array<std::string, ENCODING_COUNT> buffers;
+    std::vector<Line> lines;
+    std::vector<SocketT> senders;
+    std::chrono::steady_clock::time_point deadline;
+
+    bool empty() const { return lines.empty(); }
+
+    // A departed sender's lines still go to everyone else, but its fd may
+    // be handed to a new client before the flush, so they stop naming it.
+    void disown(SocketT sender) {
+        if (std::erase(senders, sender) == 0) {
+            return;
+        }
+        for (auto& line : lines) {
+            if (line.sender == sender) {
+                line.sender = -1;
+            }
+        }
+    }
+
+    void clear() {
+        for (auto& buffer : buffers) buffer.clear();
+        lines.clear();
+        senders.clear();
+    }
+};
+
+// Departures held for one window and announced together, so a mass
+// disconnect costs each remaining client one message instead of one per
+// departure. Senders are the departed connection ids binary frames carry.
+template<SocketType SocketT = int>
+struct Departures {
+    std::vector<Nickname> nicknames;
+    std::vector<SocketT> senders;
+    std::chrono::steady_clock::time_point deadline;
+
+    bool empty() const { return nicknames.empty(); }
+
+    void clear() {
+        nicknames.clear();
+        senders.clear();
+    }
+};
+
+using SharedBuffer = std::shared_ptr<const std::string>;
+
+// Buffers handed to the kernel with MSG_ZEROCOPY on one socket, kept alive
+// until the error queue reports that the kernel has released them.
+struct ZerocopyState {
+    std::uint32_t next_id = 0;
+    std::deque<std::pair<std::uint32_t, SharedBuffer>> pending;
+};
+
+// A departed client whose zerocopy buffers the kernel may still read. Its
+// descriptor stays open, unwatched and shut down, so completions can still
+// be read and the number cannot go to a new client in the meantime.
+template<SocketType SocketT = int>
+struct ZerocopyGrave {
+    SocketT fd;
+    ZerocopyState state;
+    std::chrono::steady_clock::time_point deadline;
+};
+
+// Per-connection counters used to report segments per message.
+struct TrafficStats {
+    std::uint64_t first_line = 0;
+    std::uint64_t own_lines = 0;
+};
+
+enum class ListenerKind : std::uint8_t {
+    Tcp,
+    Unix,
+    Handoff,
+    WebSocket,
+    Tls,
+    Peer,
+};
+
+// A user on another node. Presence keys them below -1, so they never clash
+// with a descriptor or the "no sender" id.
+template<SocketType SocketT>
+struct RemoteUser {
+    SocketT peer;
+    SocketT key;
+};
+
+template<SocketType SocketT>
+struct RoomMember {
+    SocketT socket;
+    Encoding encoding;
+    Nickname nickname;
+};
+
+// A named room as seen by one node. Every node tracks its own members;
+// only the owner, chosen on the hash ring, counts members on other nodes
+// and fans each event out once per member node.
+template<SocketType SocketT>
+struct Room {
+    std::vector<RoomMember<SocketT>> members;
+    // Lines held for members while the batch window is open.
+    Batch<SocketT> batch;
+    // Members who left, here or on another node, within the departure window.
+    Departures<SocketT> departures;
+    std::unordered_map<SocketT, std::uint32_t> member_nodes;
+    // Node our members are currently registered with.
+    std::string owner;
+};
+
+// A nickname asked of its home node on behalf of a client.
+template<SocketType SocketT>
+struct NicknameClaim {
+    Nickname nickname;
+    SocketT home;
+    std::chrono::steady_clock::time_point started;
+};
+
+// This node's right to a nickname, granted by the name's home node. While a
+// local client uses it the lease is open-ended; afterwards it stays cached
+// for the lease time, so a client reconnecting here gets the name back
+// without a round trip, and nobody on another node can take it meanwhile.
+struct NicknameLease {
+    bool in_use = false;
+    std::chrono::steady_clock::time_point expires;
+};
+
+// Time from nickname to welcome, in power-of-two microsecond buckets.
+struct RegistrationStats {
+    std::uint64_t local = 0;
+    std::uint64_t round_trips = 0;
+    std::array<std::uint64_t, 32> buckets{};
+
+    void record(std::chrono::steady_clock::duration latency, bool round_trip) {
+        ++(round_trip ? round_trips : local);
+        auto micros = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+        ++buckets[std::min<size_t>(std::bit_width(static_cast<std::uint64_t>(micros)), buckets.size() - 1)];
+    }
+
+    std::uint64_t count() const { return local + round_trips; }
+
+    // Upper bound of the bucket holding the given fraction of registrations.
+    std::uint64_t percentile_micros(double fraction) const {
+        auto target = static_cast<std::uint64_t>(fraction * static_cast<double>(count()));
+        std::uint64_t seen = 0;
+        for (size_t b = 0; b < buckets.size(); ++b) {
+            seen += buckets[b];
+            if (seen > target) return std::uint64_t{1} << b;
+        }
+        return std::uint64_t{1} << (buckets.size() - 1);
+    }
+};
+
+template<SocketType SocketT = int>
+struct Listener {
+    SocketT fd;
+    ListenerKind kind;
+};
+
+// Renders an AF_INET/AF_INET6 address as "host:port", unwrapping IPv4-mapped
+// IPv6 addresses so dual-stack peers print the way IPv4 users expect.
+inline std::string format_address(const sockaddr_storage& addr) {
+    char host[INET6_ADDRSTRLEN] = "?";
+    if (addr.ss_family == AF_INET) {
+        const auto& addr4 = reinterpret_cast<const sockaddr_in&>(addr);
+        inet_ntop(AF_INET, &addr4.sin_addr, host, sizeof(host));
+        return std::format("{}:{}", host, ntohs(addr4.sin_port));
+    }
+    if (addr.ss_family == AF_INET6) {
+        const auto& addr6 = reinterpret_cast<const sockaddr_in6&>(addr);
+        if (IN6_IS_ADDR_V4MAPPED(&addr6.sin6_addr)) {
+            inet_ntop(AF_INET, &addr6.sin6_addr.s6_addr[12], host, sizeof(host));
+            return std::format("{}:{}", host, ntohs(addr6.sin6_port));
+        }
+        inet_ntop(AF_INET6, &addr6.sin6_addr, host, sizeof(host));
+        return std::format("[{}]:{}", host, ntohs(addr6.sin6_port));
+    }
+    return host;
+}
+
+template<SocketType SocketT = int, ClientContainer Container = FdClientStore<SocketT>, Transport Net = EpollTransport>
+class ChatServer {
+    // bench/chat_bench.cpp times single steps of the pipeline through this.
+    friend struct ChatServerBench;
+
+private:
+    Container clients;
+    std::vector<Listener<SocketT>> listeners;
+    size_t connection_count = 0;
+    ServerOptions options;
+    Net transport;
+    // Descriptors reported by the last wait.
+    std::vector<int> ready_fds;
+    std::unique_ptr<FanoutPool> fanout_pool;
+    Mailbox<Delivery<SocketT>> inbox{MAILBOX_CAPACITY};
+    Batch<SocketT> batch;
+    // Rooms whose own batch holds lines, oldest first; flushed with the lobby's.
+    std::vector<std::string> batched_rooms;
+    Departures<SocketT> departures;
+    // Rooms holding departures, oldest first.
+    std::vector<std::string> departing_rooms;
+    std::uint64_t lines_broadcast = 0;
+    std::unordered_map<SocketT, TrafficStats> traffic;
+    std::unordered_map<SocketT, ZerocopyState> zerocopy;
+    std::vector<ZerocopyGrave<SocketT>> graveyard;
+    // Registered clients per encoding, so broadcasts only render what someone will read.
+    std::array<size_t, ENCODING_COUNT> encoding_members{};
+    // Reused across broadcasts so rendering does not allocate once warmed up.
+    std::array<std::string, ENCODING_COUNT> render_buffers;
+    DeflateEncoder deflate_encoder;
+    std::string text_scratch;
+    Presence<SocketT, Nickname, NicknameHash> presence;
+    // Partial frames from binary clients.
+    std::unordered_map<SocketT, std::string> inbound;
+    std::unique_ptr<TlsContext> tls_context;
+    std::unordered_map<SocketT, TlsSession> tls_sessions;
+    // Decrypted input from the current TLS read.
+    std::string tls_plain;
+    std::vector<Peer<SocketT>> peers;
+    std::unordered_map<Nickname, RemoteUser<SocketT>, NicknameHash> remote_users;
+    SocketT next_remote_key = -2;
+    // Keyed by the claiming client's socket, which is also the claim id on the wire.
+    std::unordered_map<SocketT, NicknameClaim<SocketT>> claims;
+    // The nicknames in claims, so registration checks them in O(1).
+    std::unordered_set<Nickname, NicknameHash> claimed;
+    std::unordered_map<Nickname, NicknameLease, NicknameHash> leases;
+    // Cached leases in expiry order; entries for leases since reused are skipped.
+    std::deque<std::pair<std::chrono::steady_clock::time_point, Nickname>> lease_expiry;
+    // As home node: which node holds each nickname homed here.
+    std::unordered_map<Nickname, std::string, NicknameHash> registry;
+    RegistrationStats registration_stats;
+    HashRing ring;
+    std::unordered_map<std::string, Room<SocketT>> rooms;
+    std::unordered_map<SocketT, std::string> client_rooms;
+    bool running = true;
+    bool handed_off = false;
+
+public:
+    explicit ChatServer(ServerOptions opts = {}, Net net = {}) : options(opts), transport(std::move(net)) {
+        options.batch_max_messages = std::clamp<size_t>(options.batch_max_messages, 1, IOV_MAX);
+        if (options.fanout_workers > 0) {
+            fanout_pool = std::make_unique<FanoutPool>(options.fanout_workers);
+        }
+
+        if (options.tls_port != 0) {
+            tls_context = std::make_unique<TlsContext>(options.tls_cert, options.tls_key);
+        }
+        if (options.node_name.empty()) {
+            options.node_name = std::format("{}:{}", options.bind_address, options.port);
+        }
+        ring.rebuild(std::span{&options.node_name, 1});
+
+        if (transport.watch(inbox.fd()) < 0) {
+            throw std::runtime_error(std::format("watching the mailbox failed: {}", strerror(errno)));
+        }
+        if (options.takeover_path.empty()) {
+            setup_server();
+        } else {
+            take_over(options.takeover_path);
+        }
+        if (!options.handoff_path.empty()) {
+            setup_handoff_listener(options.handoff_path);
+        }
+        for (const auto& address : options.peers) {
+            try {
+                add_peer(dial_peer(address));
+            } catch (const std::exception& e) {
+                // It will link to us instead once it starts, if it lists us.
+                std::print(stderr, "{}\n", e.what());
+            }
+        }
+    }
+
+    ~ChatServer() {
+        // After a handoff these are only our copies; the successor keeps the
+        // connections open, and the socket files now belong to it.
+        for (const auto& client : clients) {
+            transport.close(client.socket);
+        }
+        for (const auto& peer : peers) {
+            transport.close(peer.fd);
+        }
+        for (const auto& listener : listeners) {
+            transport.close(listener.fd);
+        }
+        if (handed_off) {
+            return;
+        }
+        if (!options.unix_socket_path.empty()) {
+            unlink(options.unix_socket_path.c_str());
+        }
+        if (!options.handoff_path.empty()) {
+            unlink(options.handoff_path.c_str());
+        }
+    }
+
+    // Thread-safe: queues a broadcast for the event loop to send.
+    bool post_broadcast(std::string message, SocketT exclude = -1) {
+        return inbox.post({std::make_shared<const std::string>(std::move(message)), exclude});
+    }
+
+    void set_batch_window(std::chrono::microseconds window, size_t max_messages) {
+        flush_batch();
+        options.batch_window = window;
+        options.batch_max_messages = std::clamp<size_t>(max_messages, 1, IOV_MAX);
+    }
+
+    void run() {
+        while (running) {
+            run_once();
+        }
+    }
+
+    // One pass of the event loop: waits for readiness (or the next batch or
+    // lease deadline) and handles everything that became ready. Returns how
+    // many descriptors were ready, so a MemoryTransport driver can loop
+    // until the server is idle.
+    int run_once() {
+        std::optional<std::chrono::steady_clock::time_point> deadline = batch_due();
+        if (!departures.empty()) {
+            deadline = std::min(deadline.value_or(departures.deadline), departures.deadline);
+        }
+        if (!departing_rooms.empty()) {
+            auto room_due = rooms.at(departing_rooms.front()).departures.deadline;
+            deadline = std::min(deadline.value_or(room_due), room_due);
+        }
+        if (!lease_expiry.empty()) {
+            deadline = std::min(deadline.value_or(lease_expiry.front().first), lease_expiry.front().first);
+        }
+        if (!graveyard.empty()) {
+            auto next_reap = std::chrono::steady_clock::now() + ZEROCOPY_REAP_INTERVAL;
+            deadline = std::min(deadline.value_or(next_reap), next_reap);
+        }
+        std::optional<std::chrono::microseconds> timeout;
+        if (deadline) {
+            auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+                *deadline - std::chrono::steady_clock::now());
+            timeout = std::max(remaining, std::chrono::microseconds{0});
+        }
+
+        int ready = transport.wait(timeout, ready_fds);
+        auto now = std::chrono::steady_clock::now();
+        if (!graveyard.empty()) {
+            reap_graveyard(now);
+        }
+        if (!departures.empty() && now >= departures.deadline) {
+            flush_departures();
+        }
+        while (!departing_rooms.empty() && now >= rooms.at(departing_rooms.front()).departures.deadline) {
+            flush_room_departures(departing_rooms.front());
+        }
+        if (auto due = batch_due(); due && now >= *due) {
+            flush_batch();
+        }
+        expire_leases(now);
+        if (ready < 0) {
+            if (errno != EINTR) {
+                std::print(stderr, "wait error: {}\n", strerror(errno));
+            }
+            return 0;
+        }
+
+        for (SocketT fd : ready_fds) {
+            if (!running) {
+                break;
+            } else if (auto listener = find_listener(fd); listener && listener->kind == ListenerKind::Handoff) {
+                hand_off(listener->fd);
+            } else if (listener && listener->kind == ListenerKind::Peer) {
+                accept_peer(listener->fd);
+            } else if (listener) {
+                handle_new_connection(*listener);
+            } else if (find_peer(fd)) {
+                handle_peer_data(fd);
+            } else if (fd == inbox.fd()) {
+                inbox.drain([this](Delivery<SocketT> delivery) {
+                    broadcast({EventType::Notice, delivery.exclude, {}, *delivery.payload});
+                });
+            } else {
+                handle_client_data(fd);
+            }
+        }
+        return ready;
+    }
+
+private:
+    void setup_server() {
+        std::print("🚀 Server running on {}\n", setup_tcp_listener(options.port, ListenerKind::Tcp));
+        if (options.websocket_port != 0) {
+            std::print("🌐 WebSocket gateway on {}\n", setup_tcp_listener(options.websocket_port, ListenerKind::WebSocket));
+        }
+        if (options.tls_port != 0) {
+            std::print("🔒 TLS on {}\n", setup_tcp_listener(options.tls_port, ListenerKind::Tls));
+        }
+        if (options.peer_port != 0) {
+            std::print("🔗 Peer links for node {} on {}\n", options.node_name,
+                       setup_tcp_listener(options.peer_port, ListenerKind::Peer));
+        }
+
+        if (!options.unix_socket_path.empty()) {
+            setup_unix_listener(options.unix_socket_path);
+        }
+    }
+
+    // Binds bind_address:port and returns the address for logging.
+    std::string setup_tcp_listener(std::uint16_t port, ListenerKind kind) {
+        sockaddr_storage server_addr{};
+        socklen_t addrlen = 0;
+        if (auto* addr6 = reinterpret_cast<sockaddr_in6*>(&server_addr);
+            inet_pton(AF_INET6, options.bind_address.c_str(), &addr6->sin6_addr) == 1) {
+            addr6->sin6_family = AF_INET6;
+            addr6->sin6_port = htons(port);
+            addrlen = sizeof(sockaddr_in6);
+        } else if (auto* addr4 = reinterpret_cast<sockaddr_in*>(&server_addr);
+                   inet_pton(AF_INET, options.bind_address.c_str(), &addr4->sin_addr) == 1) {
+            addr4->sin_family = AF_INET;
+            addr4->sin_port = htons(port);
+            addrlen = sizeof(sockaddr_in);
+        } else {
+            throw std::runtime_error(std::format("invalid bind address: {}", options.bind_address));
+        }
+
+        add_listener(transport.listen(reinterpret_cast<sockaddr*>(&server_addr), addrlen, options.backlog), kind);
+        return format_address(server_addr);
+    }
+
+    void setup_unix_listener(const std::string& path) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            throw std::runtime_error(std::format("unix socket path too long: {}", path));
+        }
+        std::memcpy(addr.sun_path, path.data(), path.size());
+
+        // A stale socket file from a previous run would make bind fail.
+        unlink(path.c_str());
+        try {
+            add_listener(transport.listen(reinterpret_cast<sockaddr*>(&addr), sizeof(addr), options.backlog),
+                         ListenerKind::Unix);
+        } catch (const std::exception& e) {
+            throw std::runtime_error(std::format("unix:{}: {}", path, e.what()));
+        }
+        std::print("🚀 Server running on unix:{}\n", path);
+    }
+
+    void setup_handoff_listener(const std::string& path) {
+        sockaddr_un addr = handoff_address(path);
+        SocketT handoff_socket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (handoff_socket < 0) {
+            throw std::runtime_error(std::format("socket failed: {}", strerror(errno)));
+        }
+
+        // Linux creates the socket file with the socket's own mode, so the
+        // path is owner-only from the moment it exists.
+        if (fchmod(handoff_socket, S_IRUSR | S_IWUSR) < 0) {
+            close(handoff_socket);
+            throw std::runtime_error(std::format("fchmod {} failed: {}", path, strerror(errno)));
+        }
+        unlink(path.c_str());
+        if (bind(handoff_socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+            chmod(path.c_str(), S_IRUSR | S_IWUSR) < 0 ||
+            listen(handoff_socket, options.backlog) < 0) {
+            close(handoff_socket);
+            throw std::runtime_error(std::format("bind {} failed: {}", path, strerror(errno)));
+        }
+
+        add_listener(handoff_socket, ListenerKind::Handoff);
+        std::print("🔁 Accepting handoff requests on {}\n", path);
+    }
+
+    // Sends every listener and client to the successor that connected to
+    // the handoff socket, then stops the loop. Connections stay open the
+    // whole time, so clients never notice the restart.
+    void hand_off(SocketT handoff_listener) {
+        SocketT channel = accept(handoff_listener, nullptr, nullptr);
+        if (channel < 0) {
+            std::print(stderr, "handoff accept failed: {}\n", strerror(errno));
+            return;
+        }
+        if (!peer_is_same_user(channel)) {
+            std::print(stderr, "handoff refused: requester is not running as this user\n");
+            close(channel);
+            return;
+        }
+        // Peer links, remote users, claims and the name registry cannot be
+        // carried over, and dropping the links would make every other node
+        // announce all of our users as gone. Restart a linked node instead.
+        if (!peers.empty()) {
+            std::print(stderr, "handoff refused: linked to {} peer nodes\n", peers.size());
+            close(channel);
+            return;
+        }
+        // Checked before anyone is evicted below, so a refusal changes
+        // nothing. The evictions only clear flags and close connections,
+        // which cannot make a valid entry invalid.
+        try {
+            validate_handoff(handoff_entries());
+        } catch (const std::exception& e) {
+            std::print(stderr, "handoff refused: {}\n", e.what());
+            close(channel);
+            return;
+        }
+
+        // A TLS session's state lives in this process and cannot follow the
+        // descriptor. Those clients are told to reconnect and leave now, so
+        // the lobby hears their departures before the successor takes over.
+        std::vector<SocketT> tls_clients;
+        for (const auto& c : clients) {
+            if (c.flags & CLIENT_TLS) {
+                tls_clients.push_back(c.socket);
+            }
+        }
+        constexpr std::string_view restarting = "🔁 Server restarting, please reconnect\r\n";
+        for (SocketT socket : tls_clients) {
+            if (auto client = find_client(socket)) {
+                send_reply(socket, client->flags, restarting, FrameType::Notice, "server restarting");
+            }
+            remove_client(socket);
+        }
+        // Rooms stay behind too. Their members are told and go back to the
+        // lobby here, so everyone left in a room hears them leave.
+        std::vector<SocketT> room_members;
+        for (const auto& c : clients) {
+            if (c.flags & CLIENT_IN_ROOM) {
+                room_members.push_back(c.socket);
+            }
+        }
+        constexpr std::string_view lobby = "🚪 Server restarting, you are back in the lobby\r\n";
+        for (SocketT socket : room_members) {
+            if (auto client = find_client(socket)) {
+                leave_room(*client);
+                send_reply(socket, client->flags, lobby, FrameType::Notice, "back in the lobby");
+            }
+        }
+
+        flush_departures();
+        flush_batch();
+        inbox.drain([this](Delivery<SocketT> delivery) {
+            broadcast({EventType::Notice, delivery.exclude, {}, *delivery.payload});
+        });
+        flush_batch();
+
+        std::vector<HandoffEntry> entries = handoff_entries();
+        size_t handed_clients = static_cast<size_t>(std::ranges::count(entries, HandoffType::Client,
+                                                                        [](const HandoffEntry& e) { return e.record.type; }));
+        try {
+            send_handoff(channel, entries);
+        } catch (const HandoffBroken& e) {
+            // The successor discards a stream without its commit, but it may
+            // already hold the descriptors; two servers must never answer the
+            // same connection, so this one stops too.
+            std::print(stderr, "{}; handoff broken after sending descriptors, stopping\n", e.what());
+            close(channel);
+            running = false;
+            return;
+        } catch (const std::exception& e) {
+            std::print(stderr, "{}; nothing was sent, keeping connections\n", e.what());
+            close(channel);
+            return;
+        }
+
+        close(channel);
+        std::print("🔁 Handed off {} connections to successor\n", handed_clients);
+        handed_off = true;
+        running = false;
+    }
+
+    // Every listener but the handoff socket, and every client a successor
+    // can serve: TLS sessions cannot leave this process.
+    std::vector<HandoffEntry> handoff_entries() {
+        std::vector<HandoffEntry> entries;
+        for (const auto& listener : listeners) {
+            if (listener.kind != ListenerKind::Handoff) {
+                entries.push_back({{HandoffType::Listener, static_cast<std::uint8_t>(listener.kind), 0, {}, 0},
+                                   listener.fd, {}});
+            }
+        }
+        for (const auto& c : clients) {
+            if (c.flags & CLIENT_TLS) continue;
+            HandoffEntry entry{{HandoffType::Client, c.flags, static_cast<std::uint8_t>(c.nickname.size()), {}, 0},
+                               c.socket, {}};
+            std::memcpy(entry.record.nickname, c.nickname.view().data(), c.nickname.size());
+            if (auto it = inbound.find(c.socket); it != inbound.end()) {
+                entry.pending = it->second;
+            }
+            entries.push_back(std::move(entry));
+        }
+        return entries;
+    }
+
+    void take_over(const std::string& path) {
+        sockaddr_un addr = handoff_address(path);
+        SocketT channel = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (channel < 0) {
+            throw std::runtime_error(std::format("socket failed: {}", strerror(errno)));
+        }
+        if (connect(channel, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+            close(channel);
+            throw std::runtime_error(std::format("connect {} failed: {}", path, strerror(errno)));
+        }
+        if (!peer_is_same_user(channel)) {
+            close(channel);
+            throw std::runtime_error(std::format("{} is served by another user; refusing its descriptors", path));
+        }
+
+        std::vector<HandoffEntry> entries;
+        try {
+            entries = receive_handoff(channel);
+        } catch (...) {
+            close(channel);
+            throw;
+        }
+        close(channel);
+        // Even an idle server hands off its own port; nothing means refusal.
+        if (entries.empty()) {
+            throw std::runtime_error(std::format("{} refused the handoff; its log says why", path));
+        }
+        // All or nothing: one record this process cannot serve drops them all.
+        for (const auto& entry : entries) {
+            bool servable = entry.record.type == HandoffType::Listener
+                                ? entry.record.detail <= static_cast<std::uint8_t>(ListenerKind::Peer) &&
+                                      entry.record.detail != static_cast<std::uint8_t>(ListenerKind::Handoff)
+                                : !(entry.record.detail & (CLIENT_TLS | CLIENT_IN_ROOM));
+            if (!servable) {
+                for (const auto& dropped : entries) {
+                    close(dropped.fd);
+                }
+                throw std::runtime_error(std::format("{} handed off a connection this server cannot serve", path));
+            }
+        }
+
+        for (const auto& entry : entries) {
+            SocketT fd = entry.fd;
+            if (transport.watch(fd) < 0) {
+                std::print(stderr, "dropping handed-off socket {}: {}\n", fd, strerror(errno));
+                transport.close(fd);
+                continue;
+            }
+            if (entry.record.type == HandoffType::Listener) {
+                listeners.push_back({fd, static_cast<ListenerKind>(entry.record.detail)});
+            } else {
+                size_t length = std::min<size_t>(entry.record.nickname_length, MAX_NICKNAME_LENGTH);
+                clients.emplace_back(fd, Nickname{std::string_view{entry.record.nickname, length}});
+                if (auto client = find_client(fd)) {
+                    client->flags = entry.record.detail;
+                    if (client->flags & CLIENT_REGISTERED) {
+                        ++encoding_members[static_cast<size_t>(encoding_of(client->flags))];
+                        presence.add(fd, client->nickname);
+                    }
+                }
+                if (!entry.pending.empty()) {
+                    inbound[fd] = entry.pending;
+                }
+                // Socket options travel with the descriptor; only our
+                // bookkeeping for zerocopy completions has to be rebuilt.
+                int on = 1;
+                if (options.zerocopy_threshold > 0 &&
+                    transport.setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0) {
+                    zerocopy[fd] = {};
+                }
+                ++connection_count;
+            }
+        }
+
+        std::print("🔁 Took over {} listeners and {} connections from {}\n",
+                   listeners.size(), connection_count, path);
+    }
+
+    void add_listener(SocketT fd, ListenerKind kind) {
+        if (transport.watch(fd) < 0) {
+            int error = errno;
+            transport.close(fd);
+            throw std::runtime_error(std::format("watching listener failed: {}", strerror(error)));
+        }
+        listeners.push_back({fd, kind});
+    }
+
+    std::optional<Listener<SocketT>> find_listener(SocketT fd) const {
+        auto it = std::ranges::find(listeners, fd, &Listener<SocketT>::fd);
+        return it != listeners.end() ? std::optional(*it) : std::nullopt;
+    }
+
+    void broadcast(const ChatEvent& event) {
+        SocketT sender_fd = event.sender;
+        // Events from other nodes arrive without a sender and stop here.
+        if (!peers.empty() && sender_fd >= 0 && event.type != EventType::Notice) {
+            relay_to_peers(event);
+        }
+        // Someone who left and came back is announced in that order.
+        if (event.type == EventType::Join) {
+            flush_departures();
+        }
+        ++lines_broadcast;
+        if (auto it = traffic.find(sender_fd); it != traffic.end()) {
+            ++it->second.own_lines;
+        }
+        send_to_lobby(sender_fd, [&](std::string& out, Encoding encoding) { render_event(out, encoding, event); });
+    }
+
+    // Renders once per encoding with render(out, encoding) and sends the
+    // result to every lobby client but the sender, now or with the batch.
+    template<typename Render>
+    void send_to_lobby(SocketT sender_fd, const Render& render) {
+        send_rendered(batch, sender_fd, lobby_recipients(), render);
+    }
+
+    auto lobby_recipients() {
+        return [this](const auto& deliver) { for_each_recipient(deliver); };
+    }
+
+    auto member_recipients(const Room<SocketT>& room) {
+        return [this, &room](const auto& deliver) { for_each_member(room, deliver); };
+    }
+
+    // The lobby and every room share this: recipients(deliver) calls
+    // deliver(socket, encoding) for each one, and pending holds the lines
+    // while the batch window is open.
+    template<typename Recipients, typename Render>
+    void send_rendered(Batch<SocketT>& pending, SocketT sender_fd, const Recipients& recipients, const Render& render) {
+        if (options.batch_window.count() == 0) {
+            std::array<SharedBuffer, ENCODING_COUNT> owners;
+            std::array<std::string_view, ENCODING_COUNT> payloads;
+            for (size_t e = 0; e < ENCODING_COUNT; ++e) {
+                if (encoding_members[e] == 0) {
+                    continue;
+                }
+                render_buffers[e].clear();
+                render(render_buffers[e], static_cast<Encoding>(e));
+                if (zerocopy_eligible(render_buffers[e].size())) {
+                    owners[e] = std::make_shared<const std::string>(render_buffers[e]);
+                }
+                payloads[e] = owners[e] ? std::string_view{*owners[e]} : std::string_view{render_buffers[e]};
+            }
+
+            recipients([&](SocketT socket, Encoding encoding) {
+                if (socket != sender_fd) {
+                    auto e = static_cast<size_t>(encoding);
+                    send_broadcast(socket, payloads[e], owners[e]);
+                }
+            });
+            return;
+        }
+
+        if (pending.empty()) {
+            pending.deadline = std::chrono::steady_clock::now() + options.batch_window;
+        }
+        typename Batch<SocketT>::Line line{sender_fd, {}, {}};
+        for (size_t e = 0; e < ENCODING_COUNT; ++e) {
+            line.offset[e] = pending.buffers[e].size();
+            if (encoding_members[e] > 0) {
+                render(pending.buffers[e], static_cast<Encoding>(e));
+            }
+            line.length[e] = pending.buffers[e].size() - line.offset[e];
+        }
+        pending.lines.push_back(line);
+        if (std::ranges::find(pending.senders, sender_fd) == pending.senders.end()) {
+            pending.senders.push_back(sender_fd);
+        }
+
+        if (pending.lines.size() >= options.batch_max_messages) {
+            flush_pending(pending, recipients);
+        }
+    }
+
+    // Leaves the lobby now, or with the others who leave within the window.
+    // The departed socket is only the id binary frames carry, never the
+    // sender skipped on delivery: the kernel may already have handed the
+    // fd to a new client that should hear this.
+    void announce_departure(SocketT socket, const Nickname& nickname) {
+        // Peers keep their user lists exact, so they hear of each one.
+        if (!peers.empty() && socket >= 0) {
+            relay_to_peers({EventType::Leave, socket, nickname.view(), {}});
+        }
+        if (departures.empty()) {
+            departures.deadline = std::chrono::steady_clock::now() + options.departure_window;
+        }
+        departures.nicknames.push_back(nickname);
+        departures.senders.push_back(socket);
+        if (options.departure_window.count() == 0) {
+            flush_departures();
+        }
+    }
+
+    // A lone departure reads as usual. More become one summary line for
+    // text clients, while binary clients still get a Leave frame per name,
+    // all in the same send. Departed clients are gone, so nobody is skipped.
+    void flush_departures() {
+        if (departures.empty()) {
+            return;
+        }
+
+        ++lines_broadcast;
+        send_to_lobby(-1, [this](std::string& out, Encoding encoding) {
+            render_departures(out, encoding, departures, {});
+        });
+        departures.clear();
+    }
+
+    // The same for one room's members.
+    void flush_room_departures(const std::string& room_name) {
+        std::erase(departing_rooms, room_name);
+        Room<SocketT>& room = rooms.at(room_name);
+        bool held = !room.batch.empty();
+        send_rendered(room.batch, -1, member_recipients(room), [&](std::string& out, Encoding encoding) {
+            render_departures(out, encoding, room.departures, room_name);
+        });
+        if (!room.batch.empty() && !held) {
+            batched_rooms.push_back(room_name);
+        }
+        room.departures.clear();
+    }
+
+    void render_departures(std::string& out, Encoding encoding, const Departures<SocketT>& leaving,
+                           std::string_view room) {
+        if (leaving.nicknames.size() == 1) {
+            render_event(out, encoding, {EventType::Leave, leaving.senders[0], leaving.nicknames[0].view(), {}, room});
+            return;
+        }
+        if (encoding == Encoding::Binary) {
+            for (size_t i = 0; i < leaving.nicknames.size(); ++i) {
+                append_binary(out, {EventType::Leave, leaving.senders[i], leaving.nicknames[i].view(), {}, room});
+            }
+            return;
+        }
+        text_scratch.clear();
+        append_departures(text_scratch, leaving, room);
+        if (encoding == Encoding::Text) {
+            out += text_scratch;
+        } else {
+            wrap_text(out, encoding, text_scratch);
+        }
+    }
+
+    void append_departures(std::string& out, const Departures<SocketT>& leaving, std::string_view room) const {
+        size_t count = leaving.nicknames.size();
+        std::string names;
+        Presence<SocketT, Nickname, NicknameHash>::append_joined(
+            names, std::span{leaving.nicknames}.first(std::min(count, WELCOME_PREVIEW)));
+        if (count > WELCOME_PREVIEW) {
+            char digits[20];
+            auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), count - WELCOME_PREVIEW);
+            MORE_DEPARTURES.append_to(names, std::string_view{digits, end});
+        }
+
+        char digits[20];
+        auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), count);
+        if (room.empty()) {
+            DEPARTURES_MESSAGE.append_to(out, std::string_view{digits, end}, names);
+        } else {
+            ROOM_DEPARTURES_MESSAGE.append_to(out, std::string_view{digits, end}, room, names);
+        }
+    }
+
+    void render_event(std::string& out, Encoding encoding, const ChatEvent& event) {
+        if (encoding != Encoding::Deflate && encoding != Encoding::WebSocket) {
+            render_into(out, encoding, event);
+            return;
+        }
+        text_scratch.clear();
+        append_text(text_scratch, event);
+        wrap_text(out, encoding, text_scratch);
+    }
+
+    void wrap_text(std::string& out, Encoding encoding, std::string_view text) {
+        if (encoding == Encoding::Deflate) {
+            deflate_encoder.compress_into(out, text);
+        } else {
+            append_websocket_frame(out, WebSocketOpcode::Text, text);
+        }
+    }
+
+    // Sends everything held, in the lobby and in every room.
+    void flush_batch() {
+        flush_pending(batch, lobby_recipients());
+        for (const auto& name : batched_rooms) {
+            Room<SocketT>& room = rooms.at(name);
+            flush_pending(room.batch, member_recipients(room));
+        }
+        batched_rooms.clear();
+    }
+
+    std::optional<std::chrono::steady_clock::time_point> batch_due() const {
+        std::optional<std::chrono::steady_clock::time_point> due;
+        if (!batch.empty()) {
+            due = batch.deadline;
+        }
+        if (!batched_rooms.empty()) {
+            auto room_due = rooms.at(batched_rooms.front()).batch.deadline;
+            due = std::min(due.value_or(room_due), room_due);
+        }
+        return due;
+    }
+
+    // Recipients who sent nothing in the window share one contiguous send;
+    // senders get a gathered write that skips their own lines.
+    template<typename Recipients>
+    void flush_pending(Batch<SocketT>& pending, const Recipients& recipients) {
+        if (pending.empty()) {
+            return;
+        }
+
+        std::array<SharedBuffer, ENCODING_COUNT> owners;
+        std::array<std::string_view, ENCODING_COUNT> buffers;
+        for (size_t e = 0; e < ENCODING_COUNT; ++e) {
+            if (zerocopy_eligible(pending.buffers[e].size())) {
+                owners[e] = std::make_shared<const std::string>(std::move(pending.buffers[e]));
+            }
+            buffers[e] = owners[e] ? std::string_view{*owners[e]} : std::string_view{pending.buffers[e]};
+        }
+
+        std::ranges::sort(pending.senders);
+        recipients([&](SocketT socket, Encoding encoding) {
+            auto e = static_cast<size_t>(encoding);
+            if (buffers[e].empty()) {
+                return;
+            }
+            if (!std::ranges::binary_search(pending.senders, socket)) {
+                send_broadcast(socket, buffers[e], owners[e]);
+                return;
+            }
+
+            iovec iov[IOV_MAX];
+            size_t count = 0;
+            for (const auto& line : pending.lines) {
+                if (line.sender != socket && line.length[e] > 0) {
+                    iov[count++] = {const_cast<char*>(buffers[e].data() + line.offset[e]), line.length[e]};
+                }
+            }
+            if (count > 0) {
+                send_gathered(socket, iov, count, owners[e]);
+            }
+        });
+        pending.clear();
+    }
+
+    bool zerocopy_eligible(size_t size) const {
+        return options.zerocopy_threshold > 0 && size >= options.zerocopy_threshold;
+    }
+
+    void send_broadcast(SocketT socket, std::string_view message, const SharedBuffer& owner) {
+        iovec iov{const_cast<char*>(message.data()), message.size()};
+        send_gathered(socket, &iov, 1, owner);
+    }
+
+    // With an owner the send goes out as MSG_ZEROCOPY and the owner is kept
+    // until the kernel reports completion for this socket.
+    void send_gathered(SocketT socket, iovec* iov, size_t count, const SharedBuffer& owner) {
+        ZerocopyState* state = nullptr;
+        if (owner) {
+            if (auto it = zerocopy.find(socket); it != zerocopy.end()) {
+                state = &it->second;
+            }
+        }
+
+        if (TlsSession* session = user_space_tls(socket)) {
+            for (size_t i = 0; i < count; ++i) {
+                session->write({static_cast<const char*>(iov[i].iov_base), iov[i].iov_len});
+            }
+            return;
+        }
+
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t sent = transport.sendmsg(socket, &msg, MSG_NOSIGNAL | (state ? MSG_ZEROCOPY : 0));
+        if (sent < 0) {
+            if (errno != EPIPE) {
+                std::print(stderr, "broadcast send failed: {}\n", strerror(errno));
+            }
+            return;
+        }
+
+        if (state) {
+            state->pending.emplace_back(state->next_id++, owner);
+        }
+    }
+
+    // Session for a TLS connection the kernel does not encrypt for; kTLS
+    // connections are written like any other socket.
+    TlsSession* user_space_tls(SocketT socket) {
+        if (tls_sessions.empty()) {
+            return nullptr;
+        }
+        auto it = tls_sessions.find(socket);
+        return it != tls_sessions.end() && !it->second.kernel_send() ? &it->second : nullptr;
+    }
+
+    bool send_to(SocketT socket, std::string_view data) {
+        if (TlsSession* session = user_space_tls(socket)) {
+            return session->write(data);
+        }
+        return transport.send(socket, data.data(), data.size(), MSG_NOSIGNAL) >= 0;
+    }
+
+    // Reads MSG_ZEROCOPY completions off the error queue and drops the
+    // buffers the kernel no longer references.
+    void reap_zerocopy(SocketT socket) {
+        if (auto it = zerocopy.find(socket); it != zerocopy.end()) {
+            reap_zerocopy(socket, it->second);
+        }
+    }
+
+    void reap_zerocopy(SocketT socket, ZerocopyState& state) {
+        if (state.pending.empty()) {
+            return;
+        }
+
+        auto& pending = state.pending;
+        char control[128];
+        while (true) {
+            msghdr msg{};
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (transport.recvmsg(socket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+                break;
+            }
+
+            for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+                auto* err = reinterpret_cast<sock_extended_err*>(CMSG_DATA(cm));
+                if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                    continue;
+                }
+                std::uint32_t last = err->ee_data;
+                while (!pending.empty() && static_cast<std::int32_t>(last - pending.front().first) >= 0) {
+                    pending.pop_front();
+                }
+            }
+        }
+    }
+
+    // Closes departed sockets once the kernel has released their buffers.
+    // A peer that stops acknowledging keeps them pinned, so after the grace
+    // period the connection is reset instead: an abortive close drops the
+    // unsent queue along with the pages it referenced.
+    void reap_graveyard(std::chrono::steady_clock::time_point now) {
+        std::erase_if(graveyard, [&](ZerocopyGrave<SocketT>& grave) {
+            reap_zerocopy(grave.fd, grave.state);
+            if (!grave.state.pending.empty()) {
+                if (now < grave.deadline) {
+                    return false;
+                }
+                linger reset{1, 0};
+                transport.setsockopt(grave.fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+            }
+            transport.close(grave.fd);
+            return true;
+        });
+    }
+
+    // Calls deliver(socket, encoding) for every lobby client, spreading a large lobby over
+    // the fan-out pool when one is configured.
+    template<typename Fn>
+    void for_each_recipient(const Fn& deliver) {
+        if constexpr (requires { clients.sockets(); clients.flags(); }) {
+            auto sockets = clients.sockets();
+            auto flags = clients.flags();
+            auto fan_out = [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    if (in_lobby(flags[i])) {
+                        deliver(sockets[i], encoding_of(flags[i]));
+                    }
+                }
+            };
+
+            if (fanout_pool && sockets.size() >= options.fanout_threshold) {
+                fanout_pool->run(sockets.size(), fan_out);
+            } else {
+                fan_out(0, sockets.size());
+            }
+        } else {
+            for (const auto& client : clients | std::views::filter([](const auto& c) {
+                                          return in_lobby(c.flags);
+                                      })) {
+                deliver(client.socket, encoding_of(client.flags));
+            }
+        }
+    }
+
+    // The same for a room's members on this node.
+    template<typename Fn>
+    void for_each_member(const Room<SocketT>& room, const Fn& deliver) {
+        auto fan_out = [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                deliver(room.members[i].socket, room.members[i].encoding);
+            }
+        };
+
+        if (fanout_pool && room.members.size() >= options.fanout_threshold) {
+            fanout_pool->run(room.members.size(), fan_out);
+        } else {
+            fan_out(0, room.members.size());
+        }
+    }
+
+    std::optional<ClientRef<SocketT>> find_client(SocketT socket) {
+        return find_client_in(clients, socket);
+    }
+
+    bool nickname_exists(const Nickname& nickname) {
+        // Registered local clients and remote users are all in presence.
+        return presence.contains(nickname) || claimed.contains(nickname) || remote_users.contains(nickname);
+    }
+
+    // Sends a direct reply in the client's own encoding.
+    void send_reply(SocketT socket, std::uint8_t flags, std::string_view text,
+                    FrameType type, std::string_view payload) {
+        std::string frame;
+        std::string_view out = text;
+        if (encoding_of(flags) == Encoding::Binary) {
+            append_frame(frame, type, 0, payload);
+            out = frame;
+        } else if (encoding_of(flags) != Encoding::Text) {
+            wrap_text(frame, encoding_of(flags), text);
+            out = frame;
+        }
+        if (!send_to(socket, out) && errno != EPIPE) {
+            std::print(stderr, "send reply failed: {}\n", strerror(errno));
+        }
+    }
+
+    // A templated reply. Text clients get the fragments and arguments
+    // gathered into one sendmsg with no rendered copy; other encodings wrap
+    // or frame the rendered line as send_reply does.
+    template<size_t Slots, typename... Args>
+    void send_template(SocketT socket, std::uint8_t flags, FrameType type, std::string_view payload,
+                       const MessageTemplate<Slots>& message, const Args&... args) {
+        if (encoding_of(flags) != Encoding::Text || user_space_tls(socket)) {
+            send_reply(socket, flags, message.render(args...), type, payload);
+            return;
+        }
+        iovec iov[2 * Slots + 1];
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = message.to_iovec(iov, args...);
+        if (transport.sendmsg(socket, &msg, MSG_NOSIGNAL) < 0 && errno != EPIPE) {
+            std::print(stderr, "send reply failed: {}\n", strerror(errno));
+        }
+    }
+
+    // Called before the new client joins presence, so everyone listed is someone else.
+    void send_welcome(SocketT socket, std::uint8_t flags) {
+        size_t count = presence.size();
+        if (count == 0) {
+            send_reply(socket, flags, "🎉 Welcome! You are the only user here.\r\n", FrameType::Welcome, {});
+            return;
+        }
+
+        std::string names;
+        Presence<SocketT, Nickname, NicknameHash>::append_joined(names, presence.page(0, WELCOME_PREVIEW));
+        // A Welcome frame lists only the names; it is a prefix of the text.
+        size_t listed = names.size();
+        if (count > WELCOME_PREVIEW) {
+            char digits[20];
+            auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), count - WELCOME_PREVIEW);
+            MORE_USERS.append_to(names, std::string_view{digits, end});
+        }
+
+        char digits[20];
+        auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), count);
+        send_template(socket, flags, FrameType::Welcome, std::string_view{names}.substr(0, listed), WELCOME_MESSAGE,
+                      std::string_view{digits, end}, names);
+    }
+
+    void send_who(SocketT socket, std::uint8_t flags, std::string_view argument) {
+        size_t page = 1;
+        argument = trim(argument);
+        if (!argument.empty()) {
+            auto [ptr, ec] = std::from_chars(argument.data(), argument.data() + argument.size(), page);
+            if (ec != std::errc{} || page == 0) page = 1;
+        }
+
+        size_t pages = presence.pages(WHO_PAGE_SIZE);
+        page = std::min(page, pages);
+        std::string names;
+        Presence<SocketT, Nickname, NicknameHash>::append_joined(names, presence.page(page - 1, WHO_PAGE_SIZE));
+
+        char page_digits[20];
+        char pages_digits[20];
+        auto [page_end, ec1] = std::to_chars(page_digits, page_digits + sizeof(page_digits), page);
+        auto [pages_end, ec2] = std::to_chars(pages_digits, pages_digits + sizeof(pages_digits), pages);
+        send_template(socket, flags, FrameType::Who, names, WHO_MESSAGE, std::string_view{page_digits, page_end},
+                      std::string_view{pages_digits, pages_end}, names);
+    }
+
+    void register_client(ClientRef<SocketT> client, std::string_view name) {
+        SocketT socket = client.socket;
+        if (name.size() > MAX_NICKNAME_LENGTH) {
+            char digits[20];
+            auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), MAX_NICKNAME_LENGTH);
+            send_template(socket, client.flags, FrameType::Error, "nickname too long", NICKNAME_TOO_LONG,
+                          std::string_view{digits, end});
+            return;
+        }
+        if (name.empty() || has_control_characters(name)) {
+            constexpr std::string_view error = "❌ Nickname must be printable and not empty, choose another:\r\n> ";
+            send_reply(socket, client.flags, error, FrameType::Error, "invalid nickname");
+            return;
+        }
+
+        Nickname nickname{name};
+        if (claims.contains(socket)) {
+            return;
+        }
+        if (nickname_exists(nickname)) {
+            reject_nickname(socket, client.flags);
+            return;
+        }
+
+        auto started = std::chrono::steady_clock::now();
+        if (leases.contains(nickname)) {
+            complete_registration(client, nickname, started, false);
+        } else {
+            request_lease(client, nickname, started);
+        }
+    }
+
+    // Each nickname has a home node on the ring that decides who may hold
+    // it. Being the home settles it here; otherwise it is one round trip.
+    void request_lease(ClientRef<SocketT> client, const Nickname& nickname,
+                       std::chrono::steady_clock::time_point started) {
+        const std::string& home = ring.owner(nickname.view());
+        if (home == options.node_name) {
+            auto [it, inserted] = registry.try_emplace(nickname, options.node_name);
+            if (!inserted && it->second != options.node_name) {
+                reject_nickname(client.socket, client.flags);
+            } else {
+                complete_registration(client, nickname, started, false);
+            }
+            return;
+        }
+
+        auto peer = std::ranges::find(peers, home, &Peer<SocketT>::name);
+        std::string frame;
+        append_frame(frame, FrameType::Claim, static_cast<std::uint32_t>(client.socket), nickname.view());
+        transport.send(peer->fd, frame.data(), frame.size(), MSG_NOSIGNAL);
+        claims.insert_or_assign(client.socket, NicknameClaim<SocketT>{nickname, peer->fd, started});
+        claimed.insert(nickname);
+    }
+
+    void drop_claim(typename decltype(claims)::iterator it) {
+        claimed.erase(it->second.nickname);
+        claims.erase(it);
+    }
+
+    void cache_lease(const Nickname& nickname) {
+        auto expires = std::chrono::steady_clock::now() + options.nickname_lease;
+        leases[nickname] = {false, expires};
+        lease_expiry.emplace_back(expires, nickname);
+    }
+
+    void expire_leases(std::chrono::steady_clock::time_point now) {
+        while (!lease_expiry.empty() && lease_expiry.front().first <= now) {
+            Nickname nickname = lease_expiry.front().second;
+            lease_expiry.pop_front();
+            auto it = leases.find(nickname);
+            if (it == leases.end() || it->second.in_use || it->second.expires > now) {
+                continue;
+            }
+            leases.erase(it);
+
+            const std::string& home = ring.owner(nickname.view());
+            if (home != options.node_name) {
+                std::string frame;
+                append_frame(frame, FrameType::Release, 0, nickname.view());
+                send_to_node(home, frame);
+            } else if (auto entry = registry.find(nickname); entry != registry.end() && entry->second == options.node_name) {
+                registry.erase(entry);
+            }
+        }
+    }
+
+    void reject_nickname(SocketT socket, std::uint8_t flags) {
+        constexpr std::string_view error = "❌ Nickname taken, choose another:\r\n> ";
+        send_reply(socket, flags, error, FrameType::Error, "nickname taken");
+    }
+
+    void complete_registration(ClientRef<SocketT> client, const Nickname& nickname,
+                               std::chrono::steady_clock::time_point started, bool round_trip) {
+        SocketT socket = client.socket;
+        std::string_view name = nickname.view();
+        leases[nickname].in_use = true;
+        registration_stats.record(std::chrono::steady_clock::now() - started, round_trip);
+        if (options.registration_stats && registration_stats.count() % REGISTRATION_REPORT_INTERVAL == 0) {
+            std::print("📈 {} registrations, {} without a round trip; p50 < {}us, p99 < {}us\n",
+                       registration_stats.count(), registration_stats.local,
+                       registration_stats.percentile_micros(0.5), registration_stats.percentile_micros(0.99));
+        }
+        client.nickname = nickname;
+        client.flags |= CLIENT_REGISTERED;
+        ++encoding_members[static_cast<size_t>(encoding_of(client.flags))];
+        log("👤 Registered: {}\n", name);
+        send_welcome(socket, client.flags);
+        presence.add(socket, nickname);
+
+        broadcast({EventType::Join, socket, name, {}});
+        if (options.socket_policy.report_segments) {
+            traffic[socket] = {lines_broadcast, 0};
+        }
+    }
+
+    void report_segments(SocketT socket, std::string_view nickname) {
+        auto it = traffic.find(socket);
+        if (it == traffic.end()) {
+            return;
+        }
+
+        tcp_info info{};
+        socklen_t len = sizeof(info);
+        if (transport.getsockopt(socket, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+            // Prompt and welcome are the two direct writes every client receives.
+            std::uint64_t messages = lines_broadcast - it->second.first_line - it->second.own_lines + 2;
+            std::print("📊 {}: {} data segments for {} messages ({:.2f} per message)\n",
+                       nickname, info.tcpi_data_segs_out, messages,
+                       static_cast<double>(info.tcpi_data_segs_out) / static_cast<double>(messages));
+        }
+        traffic.erase(it);
+    }
+
+    void remove_client(SocketT socket) {
+        batch.disown(socket);
+        for (const auto& name : batched_rooms) {
+            rooms.at(name).batch.disown(socket);
+        }
+
+        if (auto client = find_client(socket)) {
+            log("❌ {} disconnected\n",
+                client->nickname.empty() ? "unknown" : client->nickname.view());
+
+            // Buffers the kernel has not released yet must outlive the
+            // client: freed, their memory could be reused for another
+            // user's data while this socket still has it queued.
+            bool buried = false;
+            if (auto it = zerocopy.find(socket); it != zerocopy.end()) {
+                reap_zerocopy(socket, it->second);
+                if (!it->second.pending.empty()) {
+                    graveyard.push_back({socket, std::move(it->second), std::chrono::steady_clock::now() + ZEROCOPY_GRACE});
+                    buried = true;
+                }
+                zerocopy.erase(it);
+            }
+
+            inbound.erase(socket);
+            tls_sessions.erase(socket);
+            if (auto it = claims.find(socket); it != claims.end()) {
+                drop_claim(it);
+            }
+            if (client->flags & CLIENT_IN_ROOM) {
+                leave_room(*client);
+            }
+
+            bool registered = client->flags & CLIENT_REGISTERED;
+            Nickname nickname = client->nickname;
+            if (registered) {
+                cache_lease(nickname);
+                report_segments(socket, nickname.view());
+                --encoding_members[static_cast<size_t>(encoding_of(client->flags))];
+                presence.remove(socket);
+            }
+            transport.shutdown(socket, SHUT_RDWR);
+            transport.unwatch(socket);
+            if (!buried) {
+                transport.close(socket);
+            }
+            erase_client(clients, socket);
+            --connection_count;
+
+            // Only once the client is gone, or an immediate flush would
+            // tell it about its own departure.
+            if (registered) {
+                announce_departure(socket, nickname);
+            }
+        }
+    }
+
+    Peer<SocketT>* find_peer(SocketT fd) {
+        auto it = std::ranges::find(peers, fd, &Peer<SocketT>::fd);
+        return it != peers.end() ? &*it : nullptr;
+    }
+
+    void accept_peer(SocketT listener) {
+        SocketT fd = transport.accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            std::print(stderr, "peer accept failed: {}\n", strerror(errno));
+            return;
+        }
+        if (!transport.can_watch(fd)) {
+            transport.close(fd);
+            return;
+        }
+        add_peer(fd);
+    }
+
+    // Both ends introduce themselves; the link is live once the other
+    // side's PeerHello arrives.
+    void add_peer(SocketT fd) {
+        int on = 1;
+        transport.setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        if (transport.watch(fd) < 0) {
+            std::print(stderr, "peer link dropped: {}\n", strerror(errno));
+            transport.close(fd);
+            return;
+        }
+        peers.push_back({fd, {}, {}});
+
+        std::string hello;
+        append_event_frame(hello, FrameType::PeerHello, 0, options.node_name, options.peer_secret);
+        transport.send(fd, hello.data(), hello.size(), MSG_NOSIGNAL);
+    }
+
+    void relay_to_peers(const ChatEvent& event) {
+        std::string frame;
+        auto type = event.type == EventType::Join    ? FrameType::Join
+                    : event.type == EventType::Leave ? FrameType::Leave
+                                                     : FrameType::Chat;
+        append_event_frame(frame, type, 0, event.nickname, event.text);
+        for (const auto& peer : peers) {
+            if (!peer.name.empty()) {
+                transport.send(peer.fd, frame.data(), frame.size(), MSG_NOSIGNAL);
+            }
+        }
+    }
+
+    void handle_peer_data(SocketT fd) {
+        char buffer[16 * 1024];
+        ssize_t bytes = transport.recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (bytes <= 0) {
+            remove_peer(fd);
+            return;
+        }
+
+        Peer<SocketT>* peer = find_peer(fd);
+        peer->inbound.append(buffer, static_cast<size_t>(bytes));
+        size_t offset = 0;
+        while (true) {
+            Frame frame;
+            size_t consumed = 0;
+            ParseStatus status = parse_frame(std::string_view{peer->inbound}.substr(offset), frame, consumed);
+            if (status == ParseStatus::Incomplete) {
+                break;
+            }
+            if (status == ParseStatus::Invalid || !handle_peer_frame(*peer, frame)) {
+                remove_peer(fd);
+                return;
+            }
+            offset += consumed;
+        }
+        peer->inbound.erase(0, offset);
+    }
+
+    // False drops the link.
+    bool handle_peer_frame(Peer<SocketT>& peer, const Frame& frame) {
+        if (peer.name.empty()) {
+            std::string_view name;
+            std::string_view secret;
+            if (frame.type != FrameType::PeerHello || !parse_event_payload(frame.payload, name, secret) ||
+                name.empty()) {
+                return false;
+            }
+            if (!same_secret(secret, options.peer_secret)) {
+                std::print(stderr, "peer {} sent the wrong --peer-secret, closing the link\n", name);
+                return false;
+            }
+            if (name == options.node_name ||
+                std::ranges::any_of(peers, [&](const auto& p) { return p.name == name; })) {
+                std::print(stderr, "duplicate link to node {}, closing it\n", name);
+                return false;
+            }
+            peer.name = name;
+            std::print("🔗 Linked with node {}\n", peer.name);
+
+            std::string roster;
+            for (const auto& c : clients) {
+                if (c.flags & CLIENT_REGISTERED) {
+                    append_event_frame(roster, FrameType::Present, 0, c.nickname.view());
+                }
+            }
+            transport.send(peer.fd, roster.data(), roster.size(), MSG_NOSIGNAL);
+            links_changed();
+            return true;
+        }
+
+        std::string_view nickname;
+        std::string_view text;
+        switch (frame.type) {
+            case FrameType::Present:
+            case FrameType::Join:
+                if (!parse_event_payload(frame.payload, nickname, text) || nickname.size() > MAX_NICKNAME_LENGTH ||
+                    has_control_characters(nickname)) {
+                    return false;
+                }
+                if (add_remote_user(peer.fd, Nickname{nickname}) && frame.type == FrameType::Join) {
+                    broadcast({EventType::Join, -1, nickname, {}});
+                }
+                return true;
+            case FrameType::Leave:
+                if (!parse_event_payload(frame.payload, nickname, text) || nickname.size() > MAX_NICKNAME_LENGTH) {
+                    return false;
+                }
+                if (auto it = remote_users.find(Nickname{nickname}); it != remote_users.end() && it->second.peer == peer.fd) {
+                    presence.remove(it->second.key);
+                    remote_users.erase(it);
+                    announce_departure(-1, Nickname{nickname});
+                }
+                return true;
+            case FrameType::Chat:
+                if (!parse_event_payload(frame.payload, nickname, text)) {
+                    return false;
+                }
+                log("📢 {}@{}: {}\n", nickname, peer.name, text);
+                broadcast({EventType::Chat, -1, nickname, text});
+                return true;
+            case FrameType::Claim:
+                answer_claim(peer, frame);
+                return true;
+            case FrameType::Grant:
+            case FrameType::Deny:
+                settle_claim(static_cast<SocketT>(frame.sender), peer.fd, frame.type == FrameType::Deny, frame.payload);
+                return true;
+            case FrameType::Release:
+                if (!frame.payload.empty() && frame.payload.size() <= MAX_NICKNAME_LENGTH) {
+                    if (auto it = registry.find(Nickname{frame.payload}); it != registry.end() && it->second == peer.name) {
+                        registry.erase(it);
+                    }
+                }
+                return true;
+            case FrameType::Hold:
+                if (!frame.payload.empty() && frame.payload.size() <= MAX_NICKNAME_LENGTH) {
+                    registry.try_emplace(Nickname{frame.payload}, peer.name);
+                }
+                return true;
+            case FrameType::RoomJoin:
+            case FrameType::RoomLeave:
+            case FrameType::RoomChat:
+            case FrameType::RoomDeliver:
+            case FrameType::RoomSync:
+                return handle_room_frame(peer, frame);
+            default:
+                return true;
+        }
+    }
+
+    bool add_remote_user(SocketT peer, const Nickname& nickname) {
+        auto [it, inserted] = remote_users.try_emplace(nickname, RemoteUser<SocketT>{peer, next_remote_key});
+        if (inserted) {
+            presence.add(next_remote_key--, nickname);
+        }
+        return inserted;
+    }
+
+    // Home side: the first node to ask holds the name until it releases it.
+    // Requests are answered in arrival order, so two nodes asking at once
+    // cannot both get it.
+    void answer_claim(const Peer<SocketT>& peer, const Frame& frame) {
+        bool deny = frame.payload.empty() || frame.payload.size() > MAX_NICKNAME_LENGTH;
+        if (!deny) {
+            auto [it, inserted] = registry.try_emplace(Nickname{frame.payload}, peer.name);
+            deny = !inserted && it->second != peer.name;
+        }
+
+        std::string reply;
+        append_frame(reply, deny ? FrameType::Deny : FrameType::Grant, frame.sender, frame.payload);
+        transport.send(peer.fd, reply.data(), reply.size(), MSG_NOSIGNAL);
+    }
+
+    void settle_claim(SocketT claimant, SocketT peer, bool denied, std::string_view name) {
+        if (name.empty() || name.size() > MAX_NICKNAME_LENGTH) {
+            return;
+        }
+        Nickname nickname{name};
+        auto it = claims.find(claimant);
+        bool pending = it != claims.end() && it->second.home == peer && it->second.nickname == nickname;
+        auto client = pending ? find_client(claimant) : std::nullopt;
+        if (!client) {
+            // The client left while we waited. Keep the lease for the usual
+            // time so the home node's record is released like any other.
+            if (!denied && !leases.contains(nickname)) {
+                cache_lease(nickname);
+            }
+            return;
+        }
+
+        auto started = it->second.started;
+        drop_claim(it);
+        if (denied || remote_users.contains(nickname)) {
+            reject_nickname(claimant, client->flags);
+        } else {
+            complete_registration(*client, nickname, started, true);
+        }
+    }
+
+    // Everyone on that node leaves, its nicknames are free again, and
+    // claims waiting on it are asked again of the names' new home.
+    void remove_peer(SocketT fd) {
+        flush_batch();
+        Peer<SocketT>* peer = find_peer(fd);
+        if (!peer->name.empty()) {
+            std::print("🔗 Lost link with node {}\n", peer->name);
+            std::erase_if(registry, [&](const auto& entry) { return entry.second == peer->name; });
+        }
+        transport.unwatch(fd);
+        transport.close(fd);
+        std::erase_if(peers, [fd](const auto& p) { return p.fd == fd; });
+
+        std::vector<Nickname> departed;
+        for (const auto& [nickname, user] : remote_users) {
+            if (user.peer == fd) departed.push_back(nickname);
+        }
+        for (const auto& nickname : departed) {
+            presence.remove(remote_users.at(nickname).key);
+            remote_users.erase(nickname);
+            announce_departure(-1, nickname);
+        }
+
+        for (auto& [name, room] : rooms) {
+            room.member_nodes.erase(fd);
+        }
+        links_changed();
+
+        std::vector<SocketT> waiting;
+        for (const auto& [claimant, claim] : claims) {
+            if (claim.home == fd) waiting.push_back(claimant);
+        }
+        for (SocketT claimant : waiting) {
+            auto it = claims.find(claimant);
+            NicknameClaim<SocketT> claim = it->second;
+            drop_claim(it);
+            if (auto client = find_client(claimant)) {
+                request_lease(*client, claim.nickname, claim.started);
+            }
+        }
+    }
+
+    bool handle_room_frame(const Peer<SocketT>& peer, const Frame& frame) {
+        std::string_view name;
+        std::string_view nickname;
+        std::string_view text;
+        if (!parse_room_payload(frame.payload, name, nickname, text) || name.empty() ||
+            name.size() > MAX_ROOM_NAME_LENGTH || has_control_characters(name) ||
+            nickname.size() > MAX_NICKNAME_LENGTH) {
+            return false;
+        }
+
+        std::string room_name{name};
+        switch (frame.type) {
+            case FrameType::RoomJoin:
+                ++rooms[room_name].member_nodes[peer.fd];
+                fan_out_room(room_name, {EventType::Join, -1, nickname, {}, name});
+                break;
+            case FrameType::RoomLeave:
+                if (auto it = rooms.find(room_name); it != rooms.end()) {
+                    auto count = it->second.member_nodes.find(peer.fd);
+                    if (count != it->second.member_nodes.end() && --count->second == 0) {
+                        it->second.member_nodes.erase(count);
+                    }
+                }
+                fan_out_room(room_name, {EventType::Leave, -1, nickname, {}, name});
+                prune_room(room_name);
+                break;
+            case FrameType::RoomChat:
+                fan_out_room(room_name, {EventType::Chat, -1, nickname, text, name});
+                break;
+            case FrameType::RoomDeliver:
+                if (frame.sender > static_cast<std::uint32_t>(EventType::Notice)) {
+                    return false;
+                }
+                deliver_room(room_name, {static_cast<EventType>(frame.sender), -1, nickname, text, name});
+                break;
+            case FrameType::RoomSync:
+                if (frame.sender == 0) {
+                    rooms[room_name].member_nodes.erase(peer.fd);
+                } else {
+                    rooms[room_name].member_nodes[peer.fd] = frame.sender;
+                }
+                prune_room(room_name);
+                break;
+            default:
+                break;
+        }
+        return true;
+    }
+
+    void join_room(ClientRef<SocketT> client, std::string_view name) {
+        name = trim(name);
+        if (name.empty() || name.size() > MAX_ROOM_NAME_LENGTH || name.find(' ') != std::string_view::npos ||
+            has_control_characters(name)) {
+            char digits[20];
+            auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), MAX_ROOM_NAME_LENGTH);
+            send_template(client.socket, client.flags, FrameType::Error, "invalid room", ROOM_USAGE,
+                          std::string_view{digits, end});
+            return;
+        }
+        if (client.flags & CLIENT_IN_ROOM) {
+            leave_room(client);
+        }
+
+        std::string room_name{name};
+        Room<SocketT>& room = rooms[room_name];
+        if (room.members.empty()) {
+            room.owner = ring.owner(room_name);
+        }
+        room.members.push_back({client.socket, encoding_of(client.flags), client.nickname});
+        client.flags |= CLIENT_IN_ROOM;
+        client_rooms[client.socket] = room_name;
+
+        send_template(client.socket, client.flags, FrameType::Notice, room_name, ROOM_ENTERED, room_name, room.owner);
+        publish_room(room_name, EventType::Join, client.nickname.view(), {});
+    }
+
+    void leave_room(ClientRef<SocketT> client) {
+        auto it = client_rooms.find(client.socket);
+        if (it == client_rooms.end()) {
+            return;
+        }
+        std::string room_name = std::move(it->second);
+        client_rooms.erase(it);
+        client.flags &= ~CLIENT_IN_ROOM;
+
+        std::erase_if(rooms[room_name].members, [&](const auto& m) { return m.socket == client.socket; });
+        publish_room(room_name, EventType::Leave, client.nickname.view(), {});
+        prune_room(room_name);
+    }
+
+    // Sends a member's event to the room's owner, or fans it out if that is us.
+    void publish_room(const std::string& room_name, EventType type, std::string_view nickname, std::string_view text) {
+        const std::string& owner = rooms[room_name].owner;
+        if (owner == options.node_name) {
+            fan_out_room(room_name, {type, -1, nickname, text, room_name});
+            return;
+        }
+
+        auto frame_type = type == EventType::Join    ? FrameType::RoomJoin
+                          : type == EventType::Leave ? FrameType::RoomLeave
+                                                     : FrameType::RoomChat;
+        std::string frame;
+        append_room_frame(frame, frame_type, 0, room_name, nickname, text);
+        send_to_node(owner, frame);
+    }
+
+    // Owner side: our own members, then one frame per node with members.
+    void fan_out_room(const std::string& room_name, const ChatEvent& event) {
+        deliver_room(room_name, event);
+        auto it = rooms.find(room_name);
+        if (it == rooms.end() || it->second.member_nodes.empty()) {
+            return;
+        }
+
+        std::string frame;
+        append_room_frame(frame, FrameType::RoomDeliver, static_cast<std::uint32_t>(event.type), room_name,
+                          event.nickname, event.text);
+        for (const auto& [peer, count] : it->second.member_nodes) {
+            transport.send(peer, frame.data(), frame.size(), MSG_NOSIGNAL);
+        }
+    }
+
+    // Our members get the event like the lobby gets a broadcast: rendered
+    // once per encoding, batched, and fanned out. Events come back from the
+    // owner without a sender, but nicknames are unique cluster-wide, so a
+    // local author is found by name and skipped.
+    void deliver_room(const std::string& room_name, const ChatEvent& event) {
+        auto it = rooms.find(room_name);
+        if (it == rooms.end()) {
+            return;
+        }
+
+        Room<SocketT>& room = it->second;
+        // Leaves wait out the departure window like the lobby's, and whoever
+        // joins or speaks next is heard after them.
+        if (event.type == EventType::Leave && options.departure_window.count() > 0) {
+            if (room.departures.empty()) {
+                room.departures.deadline = std::chrono::steady_clock::now() + options.departure_window;
+                departing_rooms.push_back(room_name);
+            }
+            room.departures.nicknames.emplace_back(event.nickname);
+            room.departures.senders.push_back(event.sender);
+            return;
+        }
+        if (!room.departures.empty()) {
+            flush_room_departures(room_name);
+        }
+        auto author = std::ranges::find(room.members, event.nickname,
+                                        [](const auto& m) { return m.nickname.view(); });
+        SocketT sender_fd = author != room.members.end() ? author->socket : -1;
+        bool held = !room.batch.empty();
+        send_rendered(room.batch, sender_fd, member_recipients(room),
+                      [&](std::string& out, Encoding encoding) { render_event(out, encoding, event); });
+        if (room.batch.empty() && held) {
+            std::erase(batched_rooms, room_name);
+        } else if (!room.batch.empty() && !held) {
+            batched_rooms.push_back(room_name);
+        }
+    }
+
+    void prune_room(const std::string& room_name) {
+        auto it = rooms.find(room_name);
+        if (it != rooms.end() && it->second.members.empty() && it->second.member_nodes.empty()) {
+            erase_room(it);
+        }
+    }
+
+    // Every room is erased through here, so batched_rooms and
+    // departing_rooms never name a room that is gone. Nobody here is left to read what it still holds.
+    auto erase_room(typename std::unordered_map<std::string, Room<SocketT>>::iterator it) {
+        if (!it->second.batch.empty()) {
+            std::erase(batched_rooms, it->first);
+        }
+        if (!it->second.departures.empty()) {
+            std::erase(departing_rooms, it->first);
+        }
+        return rooms.erase(it);
+    }
+
+    void send_to_node(const std::string& node, std::string_view frame) {
+        auto it = std::ranges::find(peers, node, &Peer<SocketT>::name);
+        if (it != peers.end()) {
+            transport.send(it->fd, frame.data(), frame.size(), MSG_NOSIGNAL);
+        }
+    }
+
+    // Called whenever a link comes or goes; rooms and nicknames whose place
+    // on the ring moved follow it.
+    void links_changed() {
+        HashRing previous = ring;
+        std::vector<std::string> nodes{options.node_name};
+        for (const auto& peer : peers) {
+            if (!peer.name.empty()) nodes.push_back(peer.name);
+        }
+        ring.rebuild(nodes);
+        rebalance_rooms();
+        rehome_nicknames(previous);
+    }
+
+    // For rooms whose owner moved, our members re-register with the new
+    // owner and the old one, if still linked, forgets them. Counts held for
+    // rooms we no longer own are dropped; the member nodes re-register those
+    // with the new owner too.
+    void rebalance_rooms() {
+        for (auto it = rooms.begin(); it != rooms.end();) {
+            auto& [name, room] = *it;
+            const std::string& owner = ring.owner(name);
+            if (owner != options.node_name) {
+                room.member_nodes.clear();
+            }
+            if (!room.members.empty() && owner != room.owner) {
+                std::string frame;
+                if (room.owner != options.node_name) {
+                    append_room_frame(frame, FrameType::RoomSync, 0, name);
+                    send_to_node(room.owner, frame);
+                }
+                if (owner != options.node_name) {
+                    frame.clear();
+                    append_room_frame(frame, FrameType::RoomSync, static_cast<std::uint32_t>(room.members.size()), name);
+                    send_to_node(owner, frame);
+                }
+                std::print("🔀 Room #{} moved from {} to {}\n", name, room.owner, owner);
+                room.owner = owner;
+            }
+            it = room.members.empty() && room.member_nodes.empty() ? erase_room(it) : std::next(it);
+        }
+    }
+
+    // Registry records move the same way: a home drops names it no longer
+    // owns, and holders re-register theirs with the new home.
+    void rehome_nicknames(const HashRing& previous) {
+        std::erase_if(registry, [&](const auto& entry) { return ring.owner(entry.first.view()) != options.node_name; });
+
+        std::unordered_map<std::string, std::string> holds;
+        for (const auto& [nickname, lease] : leases) {
+            const std::string& home = ring.owner(nickname.view());
+            if (home == previous.owner(nickname.view())) {
+                continue;
+            }
+            if (home == options.node_name) {
+                registry.try_emplace(nickname, options.node_name);
+            } else {
+                append_frame(holds[home], FrameType::Hold, 0, nickname.view());
+            }
+        }
+        for (const auto& [node, frames] : holds) {
+            send_to_node(node, frames);
+        }
+    }
+
+    // Per-connection and per-line events; --quiet leaves only startup,
+    // cluster changes and errors.
+    template<typename... Args>
+    void log(std::format_string<Args...> format, Args&&... args) {
+        if (!options.quiet) {
+            std::print(format, std::forward<Args>(args)...);
+        }
+    }
+
+    void apply_socket_policy(SocketT socket, bool allow_zerocopy) {
+        int on = 1;
+        if (options.socket_policy.nodelay) {
+            if (transport.setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0) {
+                std::print(stderr, "setsockopt TCP_NODELAY failed: {}\n", strerror(errno));
+            }
+        }
+        if (options.zerocopy_threshold > 0 && allow_zerocopy) {
+            if (transport.setsockopt(socket, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0) {
+                zerocopy[socket] = {};
+            } else {
+                std::print(stderr, "setsockopt SO_ZEROCOPY failed: {}\n", strerror(errno));
+            }
+        }
+    }
+
+    void handle_new_connection(const Listener<SocketT>& listener) {
+        sockaddr_storage client_addr;
+        socklen_t addrlen = sizeof(client_addr);
+        SocketT new_socket = transport.accept(listener.fd, reinterpret_cast<sockaddr*>(&client_addr), &addrlen);
+
+        if (new_socket < 0) {
+            std::print(stderr, "accept failed: {}\n", strerror(errno));
+            return;
+        }
+
+        if (!transport.can_watch(new_socket) || (options.max_clients > 0 && connection_count >= options.max_clients)) {
+            constexpr std::string_view full = "❌ Server is full, try again later\r\n";
+            transport.send(new_socket, full.data(), full.size(), MSG_NOSIGNAL);
+            transport.close(new_socket);
+            return;
+        }
+
+        if (listener.kind == ListenerKind::Tls && !tls_context) {
+            std::print(stderr, "TLS connection refused: no certificate configured\n");
+            transport.close(new_socket);
+            return;
+        }
+        // Nothing is recorded for the socket until it is watched, so a
+        // refusal here only has to close it.
+        if (transport.watch(new_socket) < 0) {
+            std::print(stderr, "connection refused: {}\n", strerror(errno));
+            transport.close(new_socket);
+            return;
+        }
+        if (listener.kind != ListenerKind::Unix) {
+            // kTLS does its own page handling; MSG_ZEROCOPY does not apply.
+            apply_socket_policy(new_socket, listener.kind != ListenerKind::Tls);
+        }
+
+        if (listener.kind == ListenerKind::Unix) {
+            log("✅ Connected: unix:{}\n", options.unix_socket_path);
+        } else {
+            log("✅ Connected: {}\n", format_address(client_addr));
+        }
+
+        // WebSocket and TLS clients are prompted once their handshake completes.
+        if (listener.kind == ListenerKind::WebSocket || listener.kind == ListenerKind::Tls) {
+            clients.emplace_back(new_socket, Nickname{});
+            if (listener.kind == ListenerKind::Tls) {
+                tls_sessions.try_emplace(new_socket, *tls_context, new_socket);
+            }
+            find_client(new_socket)->flags = listener.kind == ListenerKind::Tls ? CLIENT_TLS : CLIENT_WEBSOCKET;
+            ++connection_count;
+            return;
+        }
+
+        constexpr std::string_view prompt = "👋 Enter nickname:\r\n> ";
+        if (transport.send(new_socket, prompt.data(), prompt.size(), MSG_NOSIGNAL) < 0) {
+            std::print(stderr, "send prompt failed: {}\n", strerror(errno));
+            transport.unwatch(new_socket);
+            transport.close(new_socket);
+            return;
+        }
+
+        clients.emplace_back(new_socket, Nickname{});
+        ++connection_count;
+    }
+
+    void handle_client_data(SocketT socket) {
+        std::vector<char> buffer(options.buffer_size);
+        reap_zerocopy(socket);
+        ssize_t bytes = transport.recv(socket, buffer.data(), buffer.size() - 1, MSG_DONTWAIT);
+
+        if (bytes < 0) {
+            // Readiness may have come from the error queue alone.
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            if (errno == ECONNRESET || errno == EPIPE) {
+                log("Connection reset by peer (socket {})\n", socket);
+            } else {
+                std::print(stderr, "recv error: {}\n", strerror(errno));
+            }
+            remove_client(socket);
+            return;
+        }
+
+        if (bytes == 0) {
+            log("Client {} closed connection\n", socket);
+            remove_client(socket);
+            return;
+        }
+
+        auto client = find_client(socket);
+        if (!client) {
+            return;
+        }
+
+        std::string_view data(buffer.data(), static_cast<size_t>(bytes));
+        if (client->flags & CLIENT_TLS) {
+            if (!decrypt_input(*client, data)) {
+                return;
+            }
+            data = tls_plain;
+        }
+        if (client->flags & CLIENT_BINARY) {
+            handle_binary_input(*client, data);
+            return;
+        }
+        if (client->flags & CLIENT_WEBSOCKET) {
+            handle_websocket_input(*client, std::span<char>{buffer.data(), static_cast<size_t>(bytes)});
+            return;
+        }
+
+        buffer[bytes] = '\0';  // Null terminate
+        std::string_view message = data;
+        auto end_pos = message.find_first_of("\r\n");
+        if (end_pos != std::string_view::npos) {
+            message = message.substr(0, end_pos);
+        }
+
+        if (message.empty()) {
+            return;
+        }
+
+        if (!(client->flags & CLIENT_REGISTERED)) {
+            if (message == BINARY_HANDSHAKE) {
+                client->flags |= CLIENT_BINARY;
+                std::string hello;
+                append_frame(hello, FrameType::Hello, static_cast<std::uint32_t>(socket), {});
+                send_to(socket, hello);
+                return;
+            }
+            if (message == DEFLATE_HANDSHAKE) {
+                if constexpr (DeflateEncoder::available) {
+                    client->flags |= CLIENT_DEFLATE;
+                    send_reply(socket, client->flags, "👋 Enter nickname:\r\n> ", FrameType::Hello, {});
+                } else {
+                    constexpr std::string_view error = "❌ Compression not available, enter nickname:\r\n> ";
+                    send_to(socket, error);
+                }
+                return;
+            }
+        }
+        handle_line(*client, message);
+    }
+
+    // Runs the handshake until it completes, then leaves the plaintext of
+    // this read in tls_plain. False when there is nothing to process.
+    bool decrypt_input(ClientRef<SocketT> client, std::string_view ciphertext) {
+        SocketT socket = client.socket;
+        TlsSession& session = tls_sessions.at(socket);
+        session.feed(ciphertext);
+
+        if (!(client.flags & CLIENT_UPGRADED)) {
+            TlsStatus status = session.handshake();
+            if (status == TlsStatus::WantRead) {
+                return false;
+            }
+            if (status == TlsStatus::Failed) {
+                std::print(stderr, "TLS handshake failed on socket {}: {}\n", socket, tls_error());
+                remove_client(socket);
+                return false;
+            }
+            client.flags |= CLIENT_UPGRADED;
+            log("🔒 TLS established on socket {} ({})\n", socket,
+                session.kernel_send() ? "kernel encryption" : "user-space encryption, kTLS unavailable");
+            send_reply(socket, client.flags, "👋 Enter nickname:\r\n> ", FrameType::Hello, {});
+        }
+
+        tls_plain.clear();
+        if (!session.read_into(tls_plain)) {
+            log("Client {} closed TLS session\n", socket);
+            remove_client(socket);
+            return false;
+        }
+        return !tls_plain.empty();
+    }
+
+    // One line of input from a text or WebSocket client.
+    void handle_line(ClientRef<SocketT> client, std::string_view message) {
+        if (!(client.flags & CLIENT_REGISTERED)) {
+            register_client(client, message);
+        } else if (message == WHO_COMMAND || message.starts_with("/who ")) {
+            send_who(client.socket, client.flags, message.substr(WHO_COMMAND.size()));
+        } else if (message == JOIN_COMMAND || message.starts_with("/join ")) {
+            join_room(client, message.substr(JOIN_COMMAND.size()));
+        } else if (message == LEAVE_COMMAND) {
+            if (client.flags & CLIENT_IN_ROOM) {
+                leave_room(client);
+                send_reply(client.socket, client.flags, "🚪 Back in the lobby\r\n", FrameType::Notice, {});
+            }
+        } else if (client.flags & CLIENT_IN_ROOM) {
+            log("📢 #{} {}: {}\n", client_rooms[client.socket], client.nickname.view(), message);
+            publish_room(client_rooms[client.socket], EventType::Chat, client.nickname.view(), message);
+        } else {
+            log("📢 {}: {}\n", client.nickname.view(), message);
+            broadcast({EventType::Chat, client.socket, client.nickname.view(), message});
+        }
+    }
+
+    // Like binary input, whole frames are handled in place in the recv buffer
+    // (unmasking rewrites them there) and only a trailing partial frame or an
+    // unfinished upgrade request is copied aside.
+    void handle_websocket_input(ClientRef<SocketT> client, std::span<char> data) {
+        SocketT socket = client.socket;
+        std::string& pending = inbound[socket];
+        std::span<char> input = data;
+        if (!pending.empty()) {
+            pending.append(data.data(), data.size());
+            input = {pending.data(), pending.size()};
+        }
+
+        size_t offset = 0;
+        if (!(client.flags & CLIENT_UPGRADED)) {
+            std::string accept;
+            ParseStatus status = parse_upgrade_request({input.data(), input.size()}, accept, offset);
+            if (status == ParseStatus::Invalid) {
+                constexpr std::string_view bad_request = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n";
+                transport.send(socket, bad_request.data(), bad_request.size(), MSG_NOSIGNAL);
+                remove_client(socket);
+                return;
+            }
+            if (status == ParseStatus::Complete) {
+                std::string response;
+                append_upgrade_response(response, accept);
+                client.flags |= CLIENT_UPGRADED;
+                CorkGuard cork(transport, socket, options.socket_policy.cork_multipart);
+                transport.send(socket, response.data(), response.size(), MSG_NOSIGNAL);
+                send_reply(socket, client.flags, "👋 Enter nickname:\r\n> ", FrameType::Hello, {});
+            }
+        }
+
+        while (client.flags & CLIENT_UPGRADED) {
+            WebSocketFrame frame;
+            size_t consumed = 0;
+            ParseStatus status = parse_websocket_frame(input.subspan(offset), frame, consumed);
+            if (status == ParseStatus::Incomplete) {
+                break;
+            }
+            // Fragmented messages are not reassembled; browsers only split
+            // messages far larger than a chat line.
+            if (status == ParseStatus::Invalid || !frame.fin || frame.opcode == WebSocketOpcode::Continuation) {
+                std::print(stderr, "invalid WebSocket frame from socket {}\n", socket);
+                remove_client(socket);
+                return;
+            }
+            offset += consumed;
+
+            if (frame.opcode == WebSocketOpcode::Close) {
+                std::string close_frame;
+                append_websocket_frame(close_frame, WebSocketOpcode::Close, frame.payload.substr(0, 2));
+                transport.send(socket, close_frame.data(), close_frame.size(), MSG_NOSIGNAL);
+                remove_client(socket);
+                return;
+            }
+            if (frame.opcode == WebSocketOpcode::Ping) {
+                std::string pong;
+                append_websocket_frame(pong, WebSocketOpcode::Pong, frame.payload);
+                transport.send(socket, pong.data(), pong.size(), MSG_NOSIGNAL);
+                continue;
+            }
+            if (frame.opcode != WebSocketOpcode::Text && frame.opcode != WebSocketOpcode::Binary) {
+                continue;
+            }
+
+            std::string_view message = frame.payload;
+            message = message.substr(0, message.find_first_of("\r\n"));
+            if (!message.empty()) {
+                handle_line(client, message);
+            }
+        }
+
+        if (input.data() == pending.data()) {
+            pending.erase(0, offset);
+        } else {
+            pending.assign(input.data() + offset, input.size() - offset);
+        }
+    }
+
+    // Frames may arrive split across reads or several to a read; whole
+    // frames are handled straight from the recv buffer and only a trailing
+    // partial frame is copied aside.
+    void handle_binary_input(ClientRef<SocketT> client, std::string_view data) {
+        SocketT socket = client.socket;
+        std::string& pending = inbound[socket];
+        std::string_view input = data;
+        if (!pending.empty()) {
+            pending.append(data);
+            input = pending;
+        }
+
+        size_t offset = 0;
+        while (true) {
+            Frame frame;
+            size_t consumed = 0;
+            ParseStatus status = parse_frame(input.substr(offset), frame, consumed);
+            if (status == ParseStatus::Incomplete) {
+                break;
+            }
+            if (status == ParseStatus::Invalid) {
+                std::print(stderr, "invalid frame from socket {}\n", socket);
+                remove_client(socket);
+                return;
+            }
+            offset += consumed;
+            handle_frame(client, frame);
+        }
+
+        if (input.data() == pending.data()) {
+            pending.erase(0, offset);
+        } else {
+            pending.assign(input.substr(offset));
+        }
+    }
+
+    void handle_frame(ClientRef<SocketT> client, const Frame& frame) {
+        bool registered = client.flags & CLIENT_REGISTERED;
+        if (frame.type == FrameType::Nick && !registered) {
+            register_client(client, frame.payload);
+        } else if (frame.type == FrameType::Who && registered) {
+            send_who(client.socket, client.flags, frame.payload);
+        } else if (frame.type == FrameType::RoomJoin && registered) {
+            join_room(client, frame.payload);
+        } else if (frame.type == FrameType::RoomLeave && registered && (client.flags & CLIENT_IN_ROOM)) {
+            leave_room(client);
+        } else if (frame.type == FrameType::Chat && registered) {
+            if (frame.payload.empty() || has_control_characters(frame.payload)) {
+                constexpr std::string_view error = "❌ Chat lines must be printable and not empty\r\n";
+                send_reply(client.socket, client.flags, error, FrameType::Error, "invalid chat line");
+            } else if (client.flags & CLIENT_IN_ROOM) {
+                log("📢 #{} {}: {}\n", client_rooms[client.socket], client.nickname.view(), frame.payload);
+                publish_room(client_rooms[client.socket], EventType::Chat, client.nickname.view(), frame.payload);
+            } else {
+                log("📢 {}: {}\n", client.nickname.view(), frame.payload);
+                broadcast({EventType::Chat, client.socket, client.nickname.view(), frame.payload});
+            }
+        }
+    }
+};
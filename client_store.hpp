@@ -0,0 +1,371 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+constexpr size_t MAX_NICKNAME_LENGTH = 32;
+
+// Nickname stored inline with its hash so Client stays trivially copyable
+// and comparisons reject mismatches before touching the bytes.
+class Nickname {
+public:
+    Nickname() = default;
+
+    // Callers check the length first. Should one not, the name is cut at
+    // MAX_NICKNAME_LENGTH rather than overrunning chars.
+    explicit Nickname(std::string_view nick)
+        : length(static_cast<std::uint8_t>(std::min(nick.size(), MAX_NICKNAME_LENGTH))),
+          hash_value(std::hash<std::string_view>{}(nick.substr(0, length))) {
+        assert(nick.size() <= MAX_NICKNAME_LENGTH);
+        std::memcpy(chars, nick.data(), length);
+    }
+
+    std::string_view view() const { return {chars, length}; }
+    size_t hash() const { return hash_value; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+
+    friend bool operator==(const Nickname& a, const Nickname& b) {
+        return a.hash_value == b.hash_value && a.length == b.length &&
+               std::memcmp(a.chars, b.chars, a.length) == 0;
+    }
+
+private:
+    char chars[MAX_NICKNAME_LENGTH];
+    std::uint8_t length = 0;
+    size_t hash_value = 0;
+};
+
+struct NicknameHash {
+    size_t operator()(const Nickname& nickname) const { return nickname.hash(); }
+};
+
+// A descriptor; every call on it goes through the server's Transport.
+template<typename T>
+concept SocketType = std::is_integral_v<T> && std::is_signed_v<T>;
+
+template<SocketType SocketT = int>
+struct Client {
+    SocketT socket;
+    Nickname nickname;
+    std::uint8_t flags = 0;
+};
+
+static_assert(std::is_trivially_copyable_v<Client<>>);
+
+// Uniform view of one client regardless of how the container lays it out.
+template<SocketType SocketT = int>
+struct ClientRef {
+    SocketT& socket;
+    Nickname& nickname;
+    std::uint8_t& flags;
+};
+
+// Any range of clients the server can append to and remove from. Removal is
+// an erase(socket) member, a remove_if member, or std::erase_if as on
+// std::vector; a find(socket) member, where there is one, replaces the
+// linear search for a client.
+template<typename T>
+concept ClientContainer =
+    std::ranges::forward_range<T> &&
+    requires(T t, int socket, Nickname nick, std::ranges::range_reference_t<T> client) {
+        t.emplace_back(socket, nick);
+        client.socket;
+        client.nickname;
+        client.flags;
+    } &&
+    (requires(T t, int socket) { t.erase(socket); } ||
+     requires(T t) { t.remove_if([](const auto&) { return true; }); } ||
+     requires(T t) { std::erase_if(t, [](const auto&) { return true; }); });
+
+template<SocketType SocketT, ClientContainer Container>
+std::optional<ClientRef<SocketT>> find_client_in(Container& clients, SocketT socket) {
+    if constexpr (requires { { clients.find(socket) } -> std::same_as<std::optional<ClientRef<SocketT>>>; }) {
+        return clients.find(socket);
+    } else {
+        auto it = std::ranges::find_if(clients, [socket](const auto& c) { return c.socket == socket; });
+        if (it == clients.end()) return std::nullopt;
+        auto&& c = *it;
+        return ClientRef<SocketT>{c.socket, c.nickname, c.flags};
+    }
+}
+
+template<SocketType SocketT, ClientContainer Container>
+void erase_client(Container& clients, SocketT socket) {
+    auto match = [socket](const auto& c) { return c.socket == socket; };
+    if constexpr (requires { clients.erase(socket); }) {
+        clients.erase(socket);
+    } else if constexpr (requires { clients.remove_if(match); }) {
+        clients.remove_if(match);
+    } else {
+        std::erase_if(clients, match);
+    }
+}
+
+// Structure-of-arrays client storage: sockets and flags sit in their own
+// dense arrays so broadcast streams them without pulling in nicknames.
+template<SocketType SocketT = int>
+class ClientStore {
+public:
+    class iterator {
+    public:
+        using iterator_concept = std::forward_iterator_tag;
+        using value_type = ClientRef<SocketT>;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+        iterator(ClientStore* owner, size_t position) : store(owner), index(position) {}
+
+        value_type operator*() const {
+            return store->at(index);
+        }
+
+        iterator& operator++() {
+            ++index;
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator tmp = *this;
+            ++index;
+            return tmp;
+        }
+
+        bool operator==(const iterator&) const = default;
+
+    private:
+        ClientStore* store = nullptr;
+        size_t index = 0;
+    };
+
+    void emplace_back(SocketT socket, const Nickname& nickname) {
+        socket_column.push_back(socket);
+        flag_column.push_back(0);
+        nickname_column.push_back(nickname);
+    }
+
+    template<typename Pred>
+    void remove_if(Pred pred) {
+        size_t out = 0;
+        for (size_t i = 0; i < socket_column.size(); ++i) {
+            if (pred(at(i))) continue;
+            socket_column[out] = socket_column[i];
+            flag_column[out] = flag_column[i];
+            nickname_column[out] = nickname_column[i];
+            ++out;
+        }
+        socket_column.resize(out);
+        flag_column.resize(out);
+        nickname_column.resize(out);
+    }
+
+    // Moves the last client into the hole; returns its socket unless the
+    // removed client was the last one.
+    std::optional<SocketT> erase_at(size_t position) {
+        size_t last = socket_column.size() - 1;
+        std::optional<SocketT> moved;
+        if (position != last) {
+            socket_column[position] = socket_column[last];
+            flag_column[position] = flag_column[last];
+            nickname_column[position] = nickname_column[last];
+            moved = socket_column[position];
+        }
+        socket_column.pop_back();
+        flag_column.pop_back();
+        nickname_column.pop_back();
+        return moved;
+    }
+
+    ClientRef<SocketT> at(size_t position) {
+        return {socket_column[position], nickname_column[position], flag_column[position]};
+    }
+
+    std::span<const SocketT> sockets() const { return socket_column; }
+    std::span<const std::uint8_t> flags() const { return flag_column; }
+    size_t size() const { return socket_column.size(); }
+
+    iterator begin() { return {this, 0}; }
+    iterator end() { return {this, socket_column.size()}; }
+
+private:
+    std::vector<SocketT> socket_column;
+    std::vector<std::uint8_t> flag_column;
+    std::vector<Nickname> nickname_column;
+};
+
+// ClientStore plus an index from socket to position, making lookup and
+// removal O(1). Removal swaps the last client into the hole, so broadcast
+// order changes as clients leave.
+template<SocketType SocketT, typename Index>
+class IndexedClientStore {
+public:
+    using iterator = typename ClientStore<SocketT>::iterator;
+
+    void emplace_back(SocketT socket, const Nickname& nickname) {
+        index.assign(socket, store.size());
+        store.emplace_back(socket, nickname);
+    }
+
+    std::optional<ClientRef<SocketT>> find(SocketT socket) {
+        auto position = index.find(socket);
+        return position ? std::optional(store.at(*position)) : std::nullopt;
+    }
+
+    void erase(SocketT socket) {
+        auto position = index.find(socket);
+        if (!position) {
+            return;
+        }
+        index.erase(socket);
+        if (auto moved = store.erase_at(*position)) {
+            index.assign(*moved, *position);
+        }
+    }
+
+    std::span<const SocketT> sockets() const { return store.sockets(); }
+    std::span<const std::uint8_t> flags() const { return store.flags(); }
+    size_t size() const { return store.size(); }
+
+    iterator begin() { return store.begin(); }
+    iterator end() { return store.end(); }
+
+private:
+    ClientStore<SocketT> store;
+    Index index;
+};
+
+// Positions in a flat array indexed by descriptor: one load per lookup.
+// Kernel descriptors are small and reused, so the array stays about as
+// large as the highest descriptor open at once.
+template<SocketType SocketT>
+class FdIndex {
+public:
+    std::optional<size_t> find(SocketT socket) const {
+        auto slot = static_cast<size_t>(socket);
+        if (socket < 0 || slot >= positions.size() || positions[slot] == 0) {
+            return std::nullopt;
+        }
+        return positions[slot] - 1;
+    }
+
+    void assign(SocketT socket, size_t position) {
+        auto slot = static_cast<size_t>(socket);
+        if (slot >= positions.size()) {
+            positions.resize(std::max(slot + 1, positions.size() * 2));
+        }
+        positions[slot] = static_cast<std::uint32_t>(position + 1);
+    }
+
+    void erase(SocketT socket) {
+        positions[static_cast<size_t>(socket)] = 0;
+    }
+
+private:
+    // Position plus one; zero marks a descriptor that is not a client.
+    std::vector<std::uint32_t> positions;
+};
+
+// Linear-probing hash from socket to position, for descriptors too sparse
+// for FdIndex. Deletion shifts later entries of the probe run back instead
+// of leaving tombstones, so lookups stay short under connection churn.
+template<SocketType SocketT>
+class OpenAddressingIndex {
+public:
+    std::optional<size_t> find(SocketT socket) const {
+        if (slots.empty()) {
+            return std::nullopt;
+        }
+        for (size_t i = home(socket);; i = (i + 1) & mask) {
+            if (slots[i].key == socket) return slots[i].position;
+            if (slots[i].key == EMPTY) return std::nullopt;
+        }
+    }
+
+    void assign(SocketT socket, size_t position) {
+        if ((count + 1) * 2 > slots.size()) {
+            grow();
+        }
+        size_t i = home(socket);
+        while (slots[i].key != EMPTY && slots[i].key != socket) {
+            i = (i + 1) & mask;
+        }
+        if (slots[i].key == EMPTY) {
+            ++count;
+        }
+        slots[i] = {socket, static_cast<std::uint32_t>(position)};
+    }
+
+    void erase(SocketT socket) {
+        if (slots.empty()) {
+            return;
+        }
+        size_t hole = home(socket);
+        while (slots[hole].key != socket) {
+            if (slots[hole].key == EMPTY) return;
+            hole = (hole + 1) & mask;
+        }
+        for (size_t j = (hole + 1) & mask; slots[j].key != EMPTY; j = (j + 1) & mask) {
+            // An entry may fill the hole only if the hole lies between its
+            // home slot and where it sits now.
+            if (((j - home(slots[j].key)) & mask) >= ((j - hole) & mask)) {
+                slots[hole] = slots[j];
+                hole = j;
+            }
+        }
+        slots[hole].key = EMPTY;
+        --count;
+    }
+
+private:
+    static constexpr SocketT EMPTY = -1;
+
+    struct Slot {
+        SocketT key = EMPTY;
+        std::uint32_t position = 0;
+    };
+
+    // Fibonacci hashing spreads consecutive descriptors across the table.
+    size_t home(SocketT socket) const {
+        return static_cast<size_t>((static_cast<std::uint64_t>(socket) * 0x9e3779b97f4a7c15) >> shift);
+    }
+
+    void grow() {
+        std::vector<Slot> old = std::move(slots);
+        size_t capacity = std::max<size_t>(16, old.size() * 2);
+        slots.assign(capacity, Slot{});
+        mask = capacity - 1;
+        shift = 64 - std::countr_zero(capacity);
+        count = 0;
+        for (const auto& slot : old) {
+            if (slot.key != EMPTY) assign(slot.key, slot.position);
+        }
+    }
+
+    std::vector<Slot> slots;
+    size_t mask = 0;
+    int shift = 64;
+    size_t count = 0;
+};
+
+template<SocketType SocketT = int>
+using FdClientStore = IndexedClientStore<SocketT, FdIndex<SocketT>>;
+
+template<SocketType SocketT = int>
+using HashedClientStore = IndexedClientStore<SocketT, OpenAddressingIndex<SocketT>>;
+
+static_assert(ClientContainer<ClientStore<>>);
+static_assert(ClientContainer<FdClientStore<>>);
+static_assert(ClientContainer<HashedClientStore<>>);
+static_assert(ClientContainer<std::vector<Client<>>>);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#ifdef TCP_CHAT_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+// Line a text client sends instead of a nickname to receive compressed output.
+constexpr std::string_view DEFLATE_HANDSHAKE = "/deflate";
+
+// Phrases that recur in server output. Both sides preset it as the deflate
+// dictionary, so even a short chat line compresses to a few back-references.
+constexpr std::string_view DEFLATE_DICTIONARY =
+    "🎉 Welcome! You are the only user here.\r\n users online.\r\n👥 Users: "
+    " more (type /who to list them)👥 Users (page  of ❌ Nickname taken, choose another:\r\n> "
+    "👋  left the chat\r\n👋  joined the chat\r\n💬 ";
+
+// Compresses each message on its own (raw deflate, preset dictionary, no
+// shared window between messages), framed as
+//   u32 compressed length (network order) | raw deflate data
+// Because no state carries over between messages, one compressed copy of a
+// broadcast serves every compressing recipient, instead of one deflate
+// stream per connection.
+class DeflateEncoder {
+public:
+#ifdef TCP_CHAT_HAVE_ZLIB
+    static constexpr bool available = true;
+
+    explicit DeflateEncoder(int level = Z_DEFAULT_COMPRESSION) {
+        if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw std::runtime_error("deflateInit2 failed");
+        }
+    }
+
+    DeflateEncoder(const DeflateEncoder&) = delete;
+    DeflateEncoder& operator=(const DeflateEncoder&) = delete;
+
+    ~DeflateEncoder() {
+        deflateEnd(&stream);
+    }
+
+    void compress_into(std::string& out, std::string_view input) {
+        deflateReset(&stream);
+        deflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(DEFLATE_DICTIONARY.data()),
+                             static_cast<uInt>(DEFLATE_DICTIONARY.size()));
+
+        size_t header = out.size();
+        size_t bound = deflateBound(&stream, static_cast<uLong>(input.size()));
+        out.resize(header + 4 + bound);
+
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+        stream.avail_in = static_cast<uInt>(input.size());
+        stream.next_out = reinterpret_cast<Bytef*>(out.data() + header + 4);
+        stream.avail_out = static_cast<uInt>(bound);
+        deflate(&stream, Z_FINISH);
+
+        size_t compressed = bound - stream.avail_out;
+        std::uint32_t length = htonl(static_cast<std::uint32_t>(compressed));
+        std::memcpy(out.data() + header, &length, 4);
+        out.resize(header + 4 + compressed);
+    }
+
+private:
+    z_stream stream{};
+#else
+    static constexpr bool available = false;
+
+    void compress_into(std::string& out, std::string_view input) {
+        out += input;
+    }
+#endif
+};
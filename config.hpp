@@ -0,0 +1,288 @@
+#pragma once
+
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <fstream>
+#include <print>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct SocketPolicy {
+    // Interactive lines go out immediately instead of waiting on Nagle.
+    bool nodelay = true;
+    // Multi-part writes, such as the WebSocket upgrade response and its first prompt, are corked until complete.
+    bool cork_multipart = true;
+    // Log TCP segments per delivered message when a client leaves.
+    bool report_segments = false;
+};
+
+enum class EventLoop { Epoll, Select };
+
+struct ServerOptions {
+    // IPv4 or IPv6 literal; IPv6 addresses such as "::" also accept IPv4 clients.
+    std::string bind_address = "127.0.0.1";
+    std::uint16_t port = 3000;
+    // Second TCP port, on the same address, that speaks WebSocket for browsers; 0 disables.
+    std::uint16_t websocket_port = 0;
+    // Third TCP port for TLS clients, encrypted by the kernel (kTLS) where it can; 0 disables.
+    std::uint16_t tls_port = 0;
+    // Port other servers link to for federation; 0 accepts no peers.
+    std::uint16_t peer_port = 0;
+    // Servers to link to at startup, as "host:port" of their peer port.
+    std::vector<std::string> peers;
+    // Unique per cluster; defaults to bind:port.
+    std::string node_name;
+    // Every node of a cluster must use the same one; a link whose PeerHello
+    // carries another secret is closed before it can send anything else.
+    std::string peer_secret;
+    // How long a nickname stays reserved for this node after its user leaves.
+    std::chrono::seconds nickname_lease{10};
+    // Print registration latency percentiles every 1000 registrations.
+    bool registration_stats = false;
+    // Skip the log line per connection, registration and chat line.
+    bool quiet = false;
+    // PEM certificate chain and private key for the TLS port.
+    std::string tls_cert;
+    std::string tls_key;
+    // Extra AF_UNIX stream listener for co-located bots and gateways; empty disables.
+    std::string unix_socket_path;
+    int backlog = 10;
+    // Bytes read from a client socket per recv call.
+    size_t buffer_size = 1024;
+    // Connections beyond this are turned away; 0 means only the event loop's limit applies.
+    size_t max_clients = 0;
+    // select() only watches descriptors below FD_SETSIZE.
+    EventLoop event_loop = EventLoop::Epoll;
+    // Extra threads used to fan a single message out; 0 keeps every send on the loop thread.
+    size_t fanout_workers = 0;
+    // Rooms smaller than this are always sent to serially. Untuned: find the
+    // crossover on the target machine with BM_FanoutSocketpairs.
+    size_t fanout_threshold = 2048;
+    // How long broadcast() may hold lines before flushing them together; 0 sends immediately.
+    std::chrono::microseconds batch_window{0};
+    // Flush early once this many lines are waiting.
+    size_t batch_max_messages = 64;
+    // Departures within this window, from the lobby or a room, are announced
+    // as one summary; 0 announces each.
+    std::chrono::milliseconds departure_window{0};
+    SocketPolicy socket_policy;
+    // Broadcast payloads at least this large are sent with MSG_ZEROCOPY; 0 disables.
+    size_t zerocopy_threshold = 0;
+    // Unix socket on which a successor process can request our descriptors; empty disables.
+    std::string handoff_path;
+    // Take over listeners and clients from the server handing off on this path.
+    std::string takeover_path;
+};
+
+constexpr std::string_view USAGE = R"(Usage: server [port] [options]
+
+Options (also accepted as "key = value" lines in a --config file):
+  --config FILE              read options from FILE; later flags override it
+  --port N                   TCP port (default 3000)
+  --websocket-port N         also accept WebSocket clients on port N
+  --tls-port N               also accept TLS clients on port N
+  --tls-cert FILE            PEM certificate chain for --tls-port
+  --tls-key FILE             PEM private key for --tls-port
+  --peer-port N              accept federation links from other servers on port N
+  --peer HOST:PORT           link to the server with that peer port (repeatable)
+  --node-name NAME           this server's name in the cluster (default bind:port)
+  --peer-secret SECRET       shared by every node; links without it are closed
+  --nickname-lease-seconds S keep a departed user's nickname for S seconds (default 10)
+  --registration-stats BOOL  log nickname registration latency (default false)
+  --quiet BOOL               do not log connections and chat lines (default false)
+  --bind ADDRESS             IPv4 or IPv6 literal, "::" for dual-stack (default 127.0.0.1)
+  --unix-socket PATH         also listen on a Unix domain socket
+  --backlog N                listen() backlog (default 10)
+  --buffer-size BYTES        recv buffer per read (default 1024)
+  --max-clients N            refuse connections beyond N (default: no limit)
+  --event-loop NAME          epoll or select (default epoll)
+  --workers N                broadcast fan-out threads (default 0)
+  --fanout-threshold N       smallest room fanned out in parallel (default 2048, untuned)
+  --batch-window-us US       hold broadcasts up to US microseconds (default 0, off)
+  --batch-max-messages N     flush a batch after N lines (default 64)
+  --departure-window-ms MS   announce departures within MS together (default 0, off)
+  --tcp-nodelay BOOL         disable Nagle on client sockets (default true)
+  --cork BOOL                cork multi-part writes (default true)
+  --socket-stats BOOL        log segments per message on disconnect (default false)
+  --zerocopy-threshold BYTES MSG_ZEROCOPY for broadcasts this large (default 0, off)
+  --handoff-path PATH        accept a successor process's takeover request on PATH
+  --takeover PATH            start by taking over the server handing off on PATH
+  --help                     show this message
+)";
+
+template<typename T>
+T parse_number(std::string_view key, std::string_view value) {
+    T result{};
+    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (ec != std::errc{} || end != value.data() + value.size()) {
+        throw std::runtime_error(std::format("invalid value for {}: '{}'", key, value));
+    }
+    return result;
+}
+
+inline bool parse_bool(std::string_view key, std::string_view value) {
+    if (value == "1" || value == "true" || value == "on" || value == "yes") return true;
+    if (value == "0" || value == "false" || value == "off" || value == "no") return false;
+    throw std::runtime_error(std::format("invalid value for {}: '{}'", key, value));
+}
+
+inline bool is_bool_option(std::string_view key) {
+    return key == "tcp-nodelay" || key == "cork" || key == "socket-stats" || key == "registration-stats" || key == "quiet";
+}
+
+inline void apply_option(ServerOptions& options, std::string_view key, std::string_view value) {
+    if (key == "port") {
+        options.port = parse_number<std::uint16_t>(key, value);
+    } else if (key == "websocket-port") {
+        options.websocket_port = parse_number<std::uint16_t>(key, value);
+    } else if (key == "tls-port") {
+        options.tls_port = parse_number<std::uint16_t>(key, value);
+    } else if (key == "tls-cert") {
+        options.tls_cert = value;
+    } else if (key == "tls-key") {
+        options.tls_key = value;
+    } else if (key == "peer-port") {
+        options.peer_port = parse_number<std::uint16_t>(key, value);
+    } else if (key == "peer") {
+        options.peers.emplace_back(value);
+    } else if (key == "node-name") {
+        if (value.size() > 255) {
+            throw std::runtime_error("node-name must be at most 255 bytes");
+        }
+        options.node_name = value;
+    } else if (key == "peer-secret") {
+        options.peer_secret = value;
+    } else if (key == "nickname-lease-seconds") {
+        options.nickname_lease = std::chrono::seconds{parse_number<std::int64_t>(key, value)};
+        if (options.nickname_lease.count() < 0) {
+            throw std::runtime_error("nickname-lease-seconds must not be negative");
+        }
+    } else if (key == "registration-stats") {
+        options.registration_stats = parse_bool(key, value);
+    } else if (key == "quiet") {
+        options.quiet = parse_bool(key, value);
+    } else if (key == "bind") {
+        options.bind_address = value;
+    } else if (key == "unix-socket") {
+        options.unix_socket_path = value;
+    } else if (key == "backlog") {
+        options.backlog = parse_number<int>(key, value);
+    } else if (key == "buffer-size") {
+        options.buffer_size = parse_number<size_t>(key, value);
+        if (options.buffer_size < 2) {
+            throw std::runtime_error("buffer-size must be at least 2");
+        }
+    } else if (key == "max-clients") {
+        options.max_clients = parse_number<size_t>(key, value);
+    } else if (key == "event-loop") {
+        if (value == "epoll") {
+            options.event_loop = EventLoop::Epoll;
+        } else if (value == "select") {
+            options.event_loop = EventLoop::Select;
+        } else {
+            throw std::runtime_error(std::format("invalid value for {}: '{}'", key, value));
+        }
+    } else if (key == "workers") {
+        options.fanout_workers = parse_number<size_t>(key, value);
+    } else if (key == "fanout-threshold") {
+        options.fanout_threshold = parse_number<size_t>(key, value);
+    } else if (key == "batch-window-us") {
+        options.batch_window = std::chrono::microseconds{parse_number<std::int64_t>(key, value)};
+        if (options.batch_window.count() < 0) {
+            throw std::runtime_error("batch-window-us must not be negative");
+        }
+    } else if (key == "batch-max-messages") {
+        options.batch_max_messages = parse_number<size_t>(key, value);
+        if (options.batch_max_messages == 0) {
+            throw std::runtime_error("batch-max-messages must be at least 1");
+        }
+    } else if (key == "departure-window-ms") {
+        options.departure_window = std::chrono::milliseconds{parse_number<std::int64_t>(key, value)};
+        if (options.departure_window.count() < 0) {
+            throw std::runtime_error("departure-window-ms must not be negative");
+        }
+    } else if (key == "tcp-nodelay") {
+        options.socket_policy.nodelay = parse_bool(key, value);
+    } else if (key == "cork") {
+        options.socket_policy.cork_multipart = parse_bool(key, value);
+    } else if (key == "socket-stats") {
+        options.socket_policy.report_segments = parse_bool(key, value);
+    } else if (key == "zerocopy-threshold") {
+        options.zerocopy_threshold = parse_number<size_t>(key, value);
+    } else if (key == "handoff-path") {
+        options.handoff_path = value;
+    } else if (key == "takeover") {
+        options.takeover_path = value;
+    } else {
+        throw std::runtime_error(std::format("unknown option: {}", key));
+    }
+}
+
+inline std::string_view trim(std::string_view text) {
+    constexpr std::string_view whitespace = " \t\r";
+    auto begin = text.find_first_not_of(whitespace);
+    if (begin == std::string_view::npos) return {};
+    auto end = text.find_last_not_of(whitespace);
+    return text.substr(begin, end - begin + 1);
+}
+
+inline void load_config_file(ServerOptions& options, const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error(std::format("cannot open config file: {}", path));
+    }
+
+    std::string line;
+    for (size_t number = 1; std::getline(file, line); ++number) {
+        std::string_view text = trim(std::string_view{line}.substr(0, line.find('#')));
+        if (text.empty()) continue;
+
+        auto eq = text.find('=');
+        if (eq == std::string_view::npos) {
+            throw std::runtime_error(std::format("{}:{}: expected 'key = value'", path, number));
+        }
+        apply_option(options, trim(text.substr(0, eq)), trim(text.substr(eq + 1)));
+    }
+}
+
+// Flags are applied in order, so anything after --config overrides the file.
+inline ServerOptions parse_options(int argc, char** argv) {
+    ServerOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            std::print("{}", USAGE);
+            std::exit(EXIT_SUCCESS);
+        }
+
+        if (!arg.starts_with("--")) {
+            options.port = parse_number<std::uint16_t>("port", arg);
+            continue;
+        }
+
+        std::string_view key = arg.substr(2);
+        std::string_view value;
+        if (auto eq = key.find('='); eq != std::string_view::npos) {
+            value = key.substr(eq + 1);
+            key = key.substr(0, eq);
+        } else if (is_bool_option(key) && (i + 1 >= argc || std::string_view{argv[i + 1]}.starts_with("--"))) {
+            value = "true";
+        } else if (i + 1 < argc) {
+            value = argv[++i];
+        } else {
+            throw std::runtime_error(std::format("missing value for --{}", key));
+        }
+
+        if (key == "config") {
+            load_config_file(options, std::string{value});
+        } else {
+            apply_option(options, key, value);
+        }
+    }
+    return options;
+}
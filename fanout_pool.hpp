@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork-join pool that splits one index range across worker threads. The
+// calling thread takes the last chunk itself and returns once every chunk
+// has been processed, so anything the callback references stays valid.
+class FanoutPool {
+public:
+    explicit FanoutPool(size_t workers) {
+        threads.reserve(workers);
+        for (size_t i = 0; i < workers; ++i) {
+            threads.emplace_back([this, i] { worker_loop(i); });
+        }
+    }
+
+    FanoutPool(const FanoutPool&) = delete;
+    FanoutPool& operator=(const FanoutPool&) = delete;
+
+    ~FanoutPool() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        work_ready.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    size_t workers() const { return threads.size(); }
+
+    template<typename Fn>
+    void run(size_t count, const Fn& fn) {
+        size_t chunks = threads.size() + 1;
+        size_t chunk_size = (count + chunks - 1) / chunks;
+        if (threads.empty() || chunk_size == 0) {
+            fn(size_t{0}, count);
+            return;
+        }
+
+        {
+            std::lock_guard lock(mutex);
+            job = {&fn, [](const void* ctx, size_t begin, size_t end) { (*static_cast<const Fn*>(ctx))(begin, end); },
+                   count, chunk_size};
+            pending = threads.size();
+            ++generation;
+        }
+        work_ready.notify_all();
+
+        size_t begin = std::min(count, threads.size() * chunk_size);
+        fn(begin, count);
+
+        std::unique_lock lock(mutex);
+        work_done.wait(lock, [this] { return pending == 0; });
+    }
+
+private:
+    struct Job {
+        const void* ctx = nullptr;
+        void (*invoke)(const void*, size_t, size_t) = nullptr;
+        size_t count = 0;
+        size_t chunk_size = 0;
+    };
+
+    void worker_loop(size_t index) {
+        size_t seen = 0;
+        while (true) {
+            Job current;
+            {
+                std::unique_lock lock(mutex);
+                work_ready.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+                current = job;
+            }
+
+            size_t begin = std::min(current.count, index * current.chunk_size);
+            size_t end = std::min(current.count, begin + current.chunk_size);
+            if (begin < end) {
+                current.invoke(current.ctx, begin, end);
+            }
+
+            std::lock_guard lock(mutex);
+            if (--pending == 0) {
+                work_done.notify_one();
+            }
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+    Job job;
+    size_t pending = 0;
+    size_t generation = 0;
+    bool stopping = false;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <format>
+#include <netdb.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Federation: servers linked in a full mesh exchange joins, leaves and chat
+// lines as binary frames (see protocol.hpp), and agree on nicknames before
+// anyone registers one. Nothing is relayed, so every pair of nodes needs its
+// own link; each link is dialed by one side only.
+
+template<typename SocketT>
+struct Peer {
+    SocketT fd;
+    // Empty until the peer's PeerHello arrives.
+    std::string name;
+    // Partial frame left over from the last read.
+    std::string inbound;
+};
+
+// Connects to "host:port" ("[v6]:port" for IPv6 literals); throws on failure.
+inline int dial_peer(std::string_view address) {
+    size_t colon = address.rfind(':');
+    if (colon == std::string_view::npos) {
+        throw std::runtime_error(std::format("peer address needs a port: {}", address));
+    }
+    std::string host{address.substr(0, colon)};
+    std::string port{address.substr(colon + 1)};
+    if (host.starts_with('[') && host.ends_with(']')) {
+        host = host.substr(1, host.size() - 2);
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* results = nullptr;
+    if (int status = getaddrinfo(host.c_str(), port.c_str(), &hints, &results); status != 0) {
+        throw std::runtime_error(std::format("cannot resolve peer {}: {}", address, gai_strerror(status)));
+    }
+
+    int fd = -1;
+    for (addrinfo* ai = results; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(results);
+    if (fd < 0) {
+        throw std::runtime_error(std::format("cannot connect to peer {}", address));
+    }
+    return fd;
+}
@@ -0,0 +1,287 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+// Wire format for passing a running server's descriptors to its successor
+// over an AF_UNIX SOCK_SEQPACKET channel. A begin marker announces how many
+// records follow. Every descriptor packet carries up to HANDOFF_BATCH records
+// and, via SCM_RIGHTS, exactly one fd per record. They are followed by one
+// packet without descriptors for each record whose pending_length is
+// non-zero, holding that connection's unread input. A commit marker with the
+// same count ends the stream; without it the successor keeps nothing.
+constexpr size_t HANDOFF_BATCH = 200;
+constexpr size_t HANDOFF_NICKNAME_MAX = 64;
+constexpr size_t HANDOFF_MAX_PENDING = 128 * 1024;
+
+constexpr std::uint32_t HANDOFF_BEGIN = 0x48'4f'42'31;
+constexpr std::uint32_t HANDOFF_COMMIT = 0x48'4f'43'31;
+
+struct HandoffMarker {
+    std::uint32_t magic;
+    std::uint32_t count;
+};
+
+enum class HandoffType : std::uint8_t {
+    Listener,
+    Client,
+};
+
+struct HandoffRecord {
+    HandoffType type;
+    // Listener kind or client flags.
+    std::uint8_t detail;
+    std::uint8_t nickname_length;
+    char nickname[HANDOFF_NICKNAME_MAX];
+    std::uint32_t pending_length;
+};
+
+struct HandoffEntry {
+    HandoffRecord record;
+    int fd;
+    std::string pending;
+};
+
+inline sockaddr_un handoff_address(const std::string& path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error(std::format("handoff path too long: {}", path));
+    }
+    std::memcpy(addr.sun_path, path.data(), path.size());
+    return addr;
+}
+
+// Handoff gives away every connection, so only a process running as our
+// own user may ask for it or offer it.
+inline bool peer_is_same_user(int channel) {
+    ucred peer{};
+    socklen_t length = sizeof(peer);
+    return getsockopt(channel, SOL_SOCKET, SO_PEERCRED, &peer, &length) == 0 && peer.uid == geteuid();
+}
+
+// Thrown once a descriptor has left: the successor may hold copies of the
+// connections by then, so the sender must stop serving them.
+struct HandoffBroken : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// Everything that could make the successor refuse a record, checked before
+// anything is sent.
+inline void validate_handoff(std::span<const HandoffEntry> entries) {
+    if (entries.size() > UINT32_MAX) {
+        throw std::runtime_error("handoff has too many entries");
+    }
+    for (const auto& entry : entries) {
+        if (entry.record.type != HandoffType::Listener && entry.record.type != HandoffType::Client) {
+            throw std::runtime_error(std::format("handoff entry for fd {} has an unknown type", entry.fd));
+        }
+        if (entry.record.nickname_length > HANDOFF_NICKNAME_MAX) {
+            throw std::runtime_error(std::format("handoff nickname for fd {} too long", entry.fd));
+        }
+        if (entry.pending.size() > HANDOFF_MAX_PENDING) {
+            throw std::runtime_error(std::format("handoff pending input for fd {} too large", entry.fd));
+        }
+    }
+}
+
+inline void send_handoff_marker(int channel, std::uint32_t magic, size_t count) {
+    HandoffMarker marker{magic, static_cast<std::uint32_t>(count)};
+    if (send(channel, &marker, sizeof(marker), MSG_NOSIGNAL) < 0) {
+        throw std::runtime_error(std::format("handoff send failed: {}", strerror(errno)));
+    }
+}
+
+// The descriptor and pending input packets between the two markers. Any
+// failure after the first descriptor packet throws HandoffBroken.
+inline void send_handoff_records(int channel, std::span<const HandoffEntry> entries) {
+    bool sent_descriptors = false;
+    auto fail = [&](std::string_view what) -> void {
+        std::string message = std::format("{}: {}", what, strerror(errno));
+        if (sent_descriptors) {
+            throw HandoffBroken(message);
+        }
+        throw std::runtime_error(message);
+    };
+
+    for (size_t start = 0; start < entries.size(); start += HANDOFF_BATCH) {
+        auto chunk = entries.subspan(start, std::min(HANDOFF_BATCH, entries.size() - start));
+
+        HandoffRecord records[HANDOFF_BATCH];
+        int fds[HANDOFF_BATCH];
+        for (size_t i = 0; i < chunk.size(); ++i) {
+            records[i] = chunk[i].record;
+            records[i].pending_length = static_cast<std::uint32_t>(chunk[i].pending.size());
+            fds[i] = chunk[i].fd;
+        }
+
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))];
+        iovec iov{records, chunk.size() * sizeof(HandoffRecord)};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(chunk.size() * sizeof(int));
+
+        cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(chunk.size() * sizeof(int));
+        std::memcpy(CMSG_DATA(cm), fds, chunk.size() * sizeof(int));
+
+        if (sendmsg(channel, &msg, MSG_NOSIGNAL) < 0) {
+            fail("handoff send failed");
+        }
+        sent_descriptors = true;
+    }
+
+    for (const auto& entry : entries) {
+        if (entry.pending.empty()) continue;
+        if (send(channel, entry.pending.data(), entry.pending.size(), MSG_NOSIGNAL) < 0) {
+            fail("handoff send failed");
+        }
+    }
+}
+
+// Validates every entry first, so a refusal leaves nothing half sent.
+inline void send_handoff(int channel, std::span<const HandoffEntry> entries) {
+    validate_handoff(entries);
+    send_handoff_marker(channel, HANDOFF_BEGIN, entries.size());
+    send_handoff_records(channel, entries);
+    try {
+        send_handoff_marker(channel, HANDOFF_COMMIT, entries.size());
+    } catch (const std::exception& e) {
+        throw HandoffBroken(e.what());
+    }
+}
+
+// Returns the committed entries, or nothing when the sender closed the
+// channel without starting (it refused). Any other end to the stream closes
+// every descriptor received so far and throws.
+inline std::vector<HandoffEntry> receive_handoff(int channel) {
+    std::vector<HandoffEntry> entries;
+    auto discard = [&entries](std::string_view what) -> void {
+        for (const auto& entry : entries) {
+            close(entry.fd);
+        }
+        throw std::runtime_error(std::string{what});
+    };
+
+    bool begun = false;
+    size_t expected = 0;
+    size_t next_pending = 0;
+    std::vector<char> packet(std::max(sizeof(HandoffRecord) * HANDOFF_BATCH, HANDOFF_MAX_PENDING));
+    while (true) {
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * HANDOFF_BATCH)];
+        iovec iov{packet.data(), packet.size()};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t bytes = recvmsg(channel, &msg, MSG_CMSG_CLOEXEC);
+        if (bytes < 0) {
+            discard(std::format("handoff receive failed: {}", strerror(errno)));
+        }
+
+        // Whatever descriptors arrived are ours to close from here on.
+        cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+        size_t fd_count = 0;
+        const unsigned char* fd_data = nullptr;
+        if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+            fd_count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            fd_data = CMSG_DATA(cm);
+        }
+        auto drop_packet_fds = [&] {
+            for (size_t i = 0; i < fd_count; ++i) {
+                int fd;
+                std::memcpy(&fd, fd_data + i * sizeof(int), sizeof(int));
+                close(fd);
+            }
+        };
+
+        if (bytes == 0) {
+            if (!begun) {
+                return entries;
+            }
+            discard("handoff ended before its commit");
+        }
+        if (msg.msg_flags & (MSG_CTRUNC | MSG_TRUNC)) {
+            drop_packet_fds();
+            discard("handoff packet truncated");
+        }
+
+        if (!begun) {
+            HandoffMarker marker{};
+            if (fd_count > 0 || static_cast<size_t>(bytes) != sizeof(marker)) {
+                drop_packet_fds();
+                discard("handoff did not start with its begin marker");
+            }
+            std::memcpy(&marker, packet.data(), sizeof(marker));
+            if (marker.magic != HANDOFF_BEGIN) {
+                discard("handoff did not start with its begin marker");
+            }
+            begun = true;
+            expected = marker.count;
+            continue;
+        }
+
+        if (entries.size() < expected) {
+            size_t count = static_cast<size_t>(bytes) / sizeof(HandoffRecord);
+            if (!cm || count == 0 || count * sizeof(HandoffRecord) != static_cast<size_t>(bytes) ||
+                fd_count != count || entries.size() + count > expected) {
+                drop_packet_fds();
+                discard("handoff packet is malformed");
+            }
+            for (size_t i = 0; i < count; ++i) {
+                HandoffEntry entry{};
+                std::memcpy(&entry.record, packet.data() + i * sizeof(HandoffRecord), sizeof(HandoffRecord));
+                std::memcpy(&entry.fd, fd_data + i * sizeof(int), sizeof(int));
+                entries.push_back(std::move(entry));
+            }
+            continue;
+        }
+
+        if (fd_count > 0) {
+            drop_packet_fds();
+            discard("handoff sent more descriptors than it announced");
+        }
+        while (next_pending < entries.size() && entries[next_pending].record.pending_length == 0) {
+            ++next_pending;
+        }
+        if (next_pending < entries.size()) {
+            if (entries[next_pending].record.pending_length != static_cast<size_t>(bytes)) {
+                discard("unexpected handoff input packet");
+            }
+            entries[next_pending++].pending.assign(packet.data(), static_cast<size_t>(bytes));
+            continue;
+        }
+
+        HandoffMarker marker{};
+        if (static_cast<size_t>(bytes) != sizeof(marker)) {
+            discard("handoff ended without its commit");
+        }
+        std::memcpy(&marker, packet.data(), sizeof(marker));
+        if (marker.magic != HANDOFF_COMMIT || marker.count != entries.size()) {
+            discard("handoff commit does not match what was sent");
+        }
+        for (const auto& entry : entries) {
+            if (entry.record.nickname_length > HANDOFF_NICKNAME_MAX || entry.pending.size() > HANDOFF_MAX_PENDING) {
+                discard("handoff record is out of range");
+            }
+        }
+        return entries;
+    }
+}
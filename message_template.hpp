@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <sys/uio.h>
+
+// A server message split at compile time into constant fragments around
+// "{}" slots. Rendering sizes the output once and appends fragments and
+// arguments directly, with no format-string parsing or temporary strings.
+template<size_t Slots>
+class MessageTemplate {
+public:
+    consteval MessageTemplate(const char* pattern) {
+        std::string_view rest = pattern;
+        for (size_t i = 0; i < Slots; ++i) {
+            size_t slot = rest.find("{}");
+            if (slot == std::string_view::npos) {
+                throw "message template has fewer slots than declared";
+            }
+            fragments[i] = rest.substr(0, slot);
+            rest.remove_prefix(slot + 2);
+        }
+        if (rest.find("{}") != std::string_view::npos) {
+            throw "message template has more slots than declared";
+        }
+        fragments[Slots] = rest;
+    }
+
+    template<typename... Args>
+        requires(sizeof...(Args) == Slots)
+    size_t size(const Args&... args) const {
+        size_t total = 0;
+        for (auto fragment : fragments) total += fragment.size();
+        return (total + ... + std::string_view{args}.size());
+    }
+
+    template<typename... Args>
+        requires(sizeof...(Args) == Slots)
+    void append_to(std::string& out, const Args&... args) const {
+        out.reserve(out.size() + size(args...));
+        size_t i = 0;
+        ((out += fragments[i++], out += std::string_view{args}), ...);
+        out += fragments[Slots];
+    }
+
+    template<typename... Args>
+        requires(sizeof...(Args) == Slots)
+    std::string render(const Args&... args) const {
+        std::string out;
+        append_to(out, args...);
+        return out;
+    }
+
+    // Fills iov with fragments and arguments in order for a gathered write;
+    // iov needs room for 2 * Slots + 1 entries. Returns the entries used.
+    template<typename... Args>
+        requires(sizeof...(Args) == Slots)
+    size_t to_iovec(iovec* iov, const Args&... args) const {
+        size_t count = 0;
+        auto push = [&](std::string_view piece) {
+            if (!piece.empty()) {
+                iov[count++] = {const_cast<char*>(piece.data()), piece.size()};
+            }
+        };
+        size_t i = 0;
+        ((push(fragments[i++]), push(std::string_view{args})), ...);
+        push(fragments[Slots]);
+        return count;
+    }
+
+private:
+    std::array<std::string_view, Slots + 1> fragments{};
+};
+
+inline constexpr MessageTemplate<1> JOIN_MESSAGE{"👋 {} joined the chat\r\n"};
+inline constexpr MessageTemplate<1> LEAVE_MESSAGE{"👋 {} left the chat\r\n"};
+inline constexpr MessageTemplate<2> DEPARTURES_MESSAGE{"👋 {} users left the chat: {}\r\n"};
+inline constexpr MessageTemplate<1> MORE_DEPARTURES{" and {} more"};
+inline constexpr MessageTemplate<2> CHAT_MESSAGE{"💬 {}: {}\r\n"};
+inline constexpr MessageTemplate<2> ROOM_JOIN_MESSAGE{"👋 {} joined #{}\r\n"};
+inline constexpr MessageTemplate<2> ROOM_LEAVE_MESSAGE{"👋 {} left #{}\r\n"};
+inline constexpr MessageTemplate<3> ROOM_DEPARTURES_MESSAGE{"👋 {} users left #{}: {}\r\n"};
+inline constexpr MessageTemplate<3> ROOM_CHAT_MESSAGE{"💬 #{} {}: {}\r\n"};
+inline constexpr MessageTemplate<2> WELCOME_MESSAGE{"🎉 Welcome! {} users online.\r\n👥 Users: {}\r\n"};
+inline constexpr MessageTemplate<1> MORE_USERS{" and {} more (type /who to list them)"};
+inline constexpr MessageTemplate<3> WHO_MESSAGE{"👥 Users (page {} of {}): {}\r\n"};
+inline constexpr MessageTemplate<1> NICKNAME_TOO_LONG{"❌ Nickname too long (max {} bytes), choose another:\r\n> "};
+inline constexpr MessageTemplate<1> ROOM_USAGE{"❌ Usage: /join <room>, up to {} bytes without spaces or control characters\r\n"};
+inline constexpr MessageTemplate<2> ROOM_ENTERED{"🚪 You are in #{} (hosted by {}), /leave returns to the lobby\r\n"};
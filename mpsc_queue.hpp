@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <optional>
+#include <stdexcept>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <vector>
+
+// Bounded lock-free queue for many producers and one consumer. Each cell
+// carries a sequence number telling producers whether it is free and the
+// consumer whether it has been published (Vyukov's bounded queue).
+template<typename T>
+class MpscQueue {
+public:
+    explicit MpscQueue(size_t capacity) : cells(round_up(capacity)), mask(cells.size() - 1) {
+        for (size_t i = 0; i < cells.size(); ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    size_t capacity() const { return cells.size(); }
+
+    bool try_push(T value) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[pos & mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side only.
+    std::optional<T> try_pop() {
+        Cell& cell = cells[head & mask];
+        if (cell.sequence.load(std::memory_order_acquire) != head + 1) {
+            return std::nullopt;
+        }
+        std::optional<T> value{std::move(cell.value)};
+        cell.sequence.store(head + cells.size(), std::memory_order_release);
+        ++head;
+        return value;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value{};
+    };
+
+    static size_t round_up(size_t n) {
+        size_t size = 2;
+        while (size < n) size <<= 1;
+        return size;
+    }
+
+    std::vector<Cell> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> tail{0};
+    alignas(64) size_t head = 0;
+};
+
+// MpscQueue paired with an eventfd so an event loop can wait on it next to
+// its sockets. Producers only write the eventfd when the consumer is not
+// already due to wake, so bursts cost one syscall rather than one per item.
+template<typename T>
+class Mailbox {
+public:
+    explicit Mailbox(size_t capacity) : queue(capacity) {
+        event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (event_fd < 0) {
+            throw std::runtime_error(std::format("eventfd failed: {}", strerror(errno)));
+        }
+    }
+
+    Mailbox(const Mailbox&) = delete;
+    Mailbox& operator=(const Mailbox&) = delete;
+
+    ~Mailbox() {
+        close(event_fd);
+    }
+
+    int fd() const { return event_fd; }
+
+    bool post(T value) {
+        if (!queue.try_push(std::move(value))) {
+            return false;
+        }
+        if (!armed.exchange(true, std::memory_order_acq_rel)) {
+            std::uint64_t one = 1;
+            [[maybe_unused]] ssize_t n = write(event_fd, &one, sizeof(one));
+        }
+        return true;
+    }
+
+    // Call from the owning loop when fd() is readable.
+    template<typename Fn>
+    size_t drain(Fn&& fn) {
+        std::uint64_t count;
+        [[maybe_unused]] ssize_t n = read(event_fd, &count, sizeof(count));
+        armed.exchange(false, std::memory_order_acq_rel);
+
+        size_t drained = 0;
+        while (auto value = queue.try_pop()) {
+            fn(std::move(*value));
+            ++drained;
+        }
+        return drained;
+    }
+
+private:
+    MpscQueue<T> queue;
+    int event_fd;
+    std::atomic<bool> armed{false};
+};
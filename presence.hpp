@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Online nickname list kept up to date on join and leave, so neither the
+// welcome nor /who has to walk the whole client set. Removal swaps the last
+// entry into the hole, which keeps it O(1) at the cost of a stable order.
+// Names are indexed too, so checking whether one is online is O(1).
+template<typename Key, typename Name, typename NameHash = std::hash<Name>>
+class Presence {
+public:
+    void add(Key key, const Name& name) {
+        index_of[key] = names.size();
+        key_of[name] = key;
+        names.push_back(name);
+        keys.push_back(key);
+    }
+
+    bool contains(const Name& name) const { return key_of.contains(name); }
+
+    void remove(Key key) {
+        auto it = index_of.find(key);
+        if (it == index_of.end()) {
+            return;
+        }
+
+        size_t index = it->second;
+        index_of.erase(it);
+        if (auto named = key_of.find(names[index]); named != key_of.end() && named->second == key) {
+            key_of.erase(named);
+        }
+        if (index != names.size() - 1) {
+            names[index] = names.back();
+            keys[index] = keys.back();
+            index_of[keys[index]] = index;
+        }
+        names.pop_back();
+        keys.pop_back();
+    }
+
+    size_t size() const { return names.size(); }
+
+    size_t pages(size_t per_page) const {
+        return std::max<size_t>(1, (names.size() + per_page - 1) / per_page);
+    }
+
+    // Zero-based page; out-of-range pages are empty.
+    std::span<const Name> page(size_t index, size_t per_page) const {
+        size_t begin = std::min(names.size(), index * per_page);
+        size_t end = std::min(names.size(), begin + per_page);
+        return std::span<const Name>{names}.subspan(begin, end - begin);
+    }
+
+    static void append_joined(std::string& out, std::span<const Name> span) {
+        for (size_t i = 0; i < span.size(); ++i) {
+            if (i > 0) out += ", ";
+            out += span[i].view();
+        }
+    }
+
+private:
+    std::vector<Name> names;
+    std::vector<Key> keys;
+    std::unordered_map<Key, size_t> index_of;
+    std::unordered_map<Name, Key, NameHash> key_of;
+};
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "message_template.hpp"
+
+// Something every registered client should hear about. Each encoding class
+// renders it once per broadcast, never once per recipient.
+enum class EventType : std::uint8_t {
+    Join,
+    Leave,
+    Chat,
+    Notice,
+};
+
+struct ChatEvent {
+    EventType type;
+    int sender;
+    std::string_view nickname;
+    std::string_view text;
+    // Empty for the lobby.
+    std::string_view room = {};
+};
+
+enum class Encoding : std::uint8_t {
+    Text,
+    Binary,
+    // Text lines, each deflated on its own; see compression.hpp.
+    Deflate,
+    // Text lines, each in its own WebSocket text frame; see websocket.hpp.
+    WebSocket,
+};
+
+constexpr size_t ENCODING_COUNT = 4;
+
+// Line a text client sends instead of a nickname to switch to binary framing.
+constexpr std::string_view BINARY_HANDSHAKE = "/binary";
+// "/who [page]" lists online users a page at a time.
+constexpr std::string_view WHO_COMMAND = "/who";
+// "/join <room>" moves to a named room; "/leave" returns to the lobby.
+constexpr std::string_view JOIN_COMMAND = "/join";
+constexpr std::string_view LEAVE_COMMAND = "/leave";
+constexpr size_t MAX_ROOM_NAME_LENGTH = 32;
+
+// Binary framing: a 12-byte header in network byte order followed by the
+// payload.
+//   u32 payload length | u8 type | u8 reserved | u16 room | u32 sender id
+// Join, Leave and Chat payloads start with a u8 nickname length and the
+// nickname, so bots can route without a lookup table; Chat then carries the
+// text. Sender ids are connection ids and only unique while connected. A Who
+// request carries an optional 1-based page number in ASCII and is answered
+// with a Who frame listing that page.
+enum class FrameType : std::uint8_t {
+    Hello = 1,
+    Nick = 2,
+    Chat = 3,
+    Join = 4,
+    Leave = 5,
+    Notice = 6,
+    Welcome = 7,
+    Error = 8,
+    Who = 9,
+    // Peer links only. PeerHello carries the node name and --peer-secret
+    // laid out like an event payload; Present is a user
+    // already online when the link came up. Claim asks a nickname's home
+    // node for it, answered by Grant or Deny with the same sender id and
+    // name; Release gives a name back to its home, and Hold tells a new home
+    // about a name the sender already holds.
+    PeerHello = 10,
+    Present = 11,
+    Claim = 12,
+    Grant = 13,
+    Deny = 14,
+    // Room traffic between member nodes and the room's owner. Payloads start
+    // with a u8 room name length and the name, then continue like an event
+    // payload. RoomDeliver carries the EventType in the sender field, and
+    // RoomSync the sending node's member count for the room.
+    RoomJoin = 15,
+    RoomLeave = 16,
+    RoomChat = 17,
+    RoomDeliver = 18,
+    RoomSync = 19,
+    Release = 20,
+    Hold = 21,
+};
+
+constexpr size_t FRAME_HEADER_SIZE = 12;
+constexpr size_t MAX_FRAME_PAYLOAD = 64 * 1024;
+
+struct Frame {
+    FrameType type;
+    std::uint16_t room;
+    std::uint32_t sender;
+    std::string_view payload;
+};
+
+inline void append_frame_header(std::string& out, FrameType type, std::uint32_t sender,
+                                size_t payload_length, std::uint16_t room = 0) {
+    char header[FRAME_HEADER_SIZE];
+    std::uint32_t length = htonl(static_cast<std::uint32_t>(payload_length));
+    std::uint16_t net_room = htons(room);
+    std::uint32_t net_sender = htonl(sender);
+    std::memcpy(header, &length, 4);
+    header[4] = static_cast<char>(type);
+    header[5] = 0;
+    std::memcpy(header + 6, &net_room, 2);
+    std::memcpy(header + 8, &net_sender, 4);
+    out.append(header, sizeof(header));
+}
+
+inline void append_frame(std::string& out, FrameType type, std::uint32_t sender, std::string_view payload) {
+    append_frame_header(out, type, sender, payload.size());
+    out += payload;
+}
+
+inline void append_event_frame(std::string& out, FrameType type, std::uint32_t sender,
+                               std::string_view nickname, std::string_view text = {}) {
+    append_frame_header(out, type, sender, 1 + nickname.size() + text.size());
+    out += static_cast<char>(nickname.size());
+    out += nickname;
+    out += text;
+}
+
+inline void append_room_frame(std::string& out, FrameType type, std::uint32_t sender, std::string_view room,
+                              std::string_view nickname = {}, std::string_view text = {}) {
+    append_frame_header(out, type, sender, 2 + room.size() + nickname.size() + text.size());
+    out += static_cast<char>(room.size());
+    out += room;
+    out += static_cast<char>(nickname.size());
+    out += nickname;
+    out += text;
+}
+
+// Splits a Join, Leave, Chat or Present payload; false if malformed.
+inline bool parse_event_payload(std::string_view payload, std::string_view& nickname, std::string_view& text) {
+    if (payload.empty()) {
+        return false;
+    }
+    size_t length = static_cast<std::uint8_t>(payload[0]);
+    if (payload.size() < 1 + length) {
+        return false;
+    }
+    nickname = payload.substr(1, length);
+    text = payload.substr(1 + length);
+    return true;
+}
+
+// Names and chat text end up inside text clients' lines, so a CR or LF
+// would let them forge server lines. Any C0 control character or DEL is
+// refused wherever input does not go through the line splitter.
+inline bool has_control_characters(std::string_view text) {
+    return std::ranges::any_of(text, [](char c) {
+        auto byte = static_cast<unsigned char>(c);
+        return byte < 0x20 || byte == 0x7f;
+    });
+}
+
+// Compares a PeerHello secret in time that depends only on the lengths, so
+// a stranger cannot guess it byte by byte.
+inline bool same_secret(std::string_view a, std::string_view b) {
+    unsigned char difference = a.size() == b.size() ? 0 : 1;
+    for (size_t i = 0; i < a.size() && i < b.size(); ++i) {
+        difference |= static_cast<unsigned char>(a[i] ^ b[i]);
+    }
+    return difference == 0;
+}
+
+inline bool parse_room_payload(std::string_view payload, std::string_view& room,
+                               std::string_view& nickname, std::string_view& text) {
+    if (payload.empty()) {
+        return false;
+    }
+    size_t length = static_cast<std::uint8_t>(payload[0]);
+    if (payload.size() < 1 + length) {
+        return false;
+    }
+    room = payload.substr(1, length);
+    return parse_event_payload(payload.substr(1 + length), nickname, text);
+}
+
+enum class ParseStatus {
+    Complete,
+    Incomplete,
+    Invalid,
+};
+
+// Parses one frame from the front of buffer; on Complete, consumed is the
+// frame's total size.
+inline ParseStatus parse_frame(std::string_view buffer, Frame& frame, size_t& consumed) {
+    if (buffer.size() < FRAME_HEADER_SIZE) {
+        return ParseStatus::Incomplete;
+    }
+
+    std::uint32_t length;
+    std::uint16_t room;
+    std::uint32_t sender;
+    std::memcpy(&length, buffer.data(), 4);
+    std::memcpy(&room, buffer.data() + 6, 2);
+    std::memcpy(&sender, buffer.data() + 8, 4);
+    length = ntohl(length);
+    if (length > MAX_FRAME_PAYLOAD) {
+        return ParseStatus::Invalid;
+    }
+    if (buffer.size() < FRAME_HEADER_SIZE + length) {
+        return ParseStatus::Incomplete;
+    }
+
+    frame = {static_cast<FrameType>(buffer[4]), ntohs(room), ntohl(sender),
+             buffer.substr(FRAME_HEADER_SIZE, length)};
+    consumed = FRAME_HEADER_SIZE + length;
+    return ParseStatus::Complete;
+}
+
+inline void append_text(std::string& out, const ChatEvent& event) {
+    if (!event.room.empty()) {
+        switch (event.type) {
+            case EventType::Join:
+                ROOM_JOIN_MESSAGE.append_to(out, event.nickname, event.room);
+                return;
+            case EventType::Leave:
+                ROOM_LEAVE_MESSAGE.append_to(out, event.nickname, event.room);
+                return;
+            case EventType::Chat:
+                ROOM_CHAT_MESSAGE.append_to(out, event.room, event.nickname, event.text);
+                return;
+            case EventType::Notice:
+                break;
+        }
+    }
+    switch (event.type) {
+        case EventType::Join:
+            JOIN_MESSAGE.append_to(out, event.nickname);
+            break;
+        case EventType::Leave:
+            LEAVE_MESSAGE.append_to(out, event.nickname);
+            break;
+        case EventType::Chat:
+            CHAT_MESSAGE.append_to(out, event.nickname, event.text);
+            break;
+        case EventType::Notice:
+            out += event.text;
+            break;
+    }
+}
+
+inline void append_binary(std::string& out, const ChatEvent& event) {
+    // Room events name their room, so binary members get them as the
+    // RoomDeliver frames member nodes get from a room's owner.
+    if (!event.room.empty()) {
+        append_room_frame(out, FrameType::RoomDeliver, static_cast<std::uint32_t>(event.type), event.room,
+                          event.nickname, event.text);
+        return;
+    }
+    auto sender = static_cast<std::uint32_t>(event.sender);
+    switch (event.type) {
+        case EventType::Join:
+            append_event_frame(out, FrameType::Join, sender, event.nickname);
+            break;
+        case EventType::Leave:
+            append_event_frame(out, FrameType::Leave, sender, event.nickname);
+            break;
+        case EventType::Chat:
+            append_event_frame(out, FrameType::Chat, sender, event.nickname, event.text);
+            break;
+        case EventType::Notice: {
+            std::string_view text = event.text;
+            while (text.ends_with('\n') || text.ends_with('\r')) text.remove_suffix(1);
+            append_frame(out, FrameType::Notice, 0, text);
+            break;
+        }
+    }
+}
+
+// Appends the event as encoding renders it. Deflate and WebSocket output is
+// text here and is wrapped by the caller, which owns the compressor.
+inline void render_into(std::string& out, Encoding encoding, const ChatEvent& event) {
+    if (encoding == Encoding::Binary) {
+        append_binary(out, event);
+    } else {
+        append_text(out, event);
+    }
+}
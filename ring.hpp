@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Points each node takes on the ring; more points even out the share of
+// rooms per node and the share moved when a node comes or goes.
+constexpr size_t RING_POINTS_PER_NODE = 64;
+
+// FNV-1a with a final avalanche, spelled out because every node must place
+// a room identically and std::hash makes no promise across builds. Without
+// the finalizer, names differing only in their last byte ("room1",
+// "room2") land next to each other on the ring.
+constexpr std::uint64_t stable_hash(std::string_view text, std::uint64_t seed = 0xcbf29ce484222325) {
+    std::uint64_t hash = seed;
+    for (char c : text) {
+        hash ^= static_cast<std::uint8_t>(c);
+        hash *= 0x100000001b3;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Consistent-hash placement of rooms onto nodes. Adding or removing a node
+// only moves the rooms whose nearest point belonged to it.
+class HashRing {
+public:
+    void rebuild(std::span<const std::string> nodes) {
+        points.clear();
+        for (const auto& node : nodes) {
+            std::uint64_t seed = stable_hash(node);
+            for (size_t i = 0; i < RING_POINTS_PER_NODE; ++i) {
+                char index = static_cast<char>(i);
+                points.emplace_back(stable_hash({&index, 1}, seed), node);
+                seed = points.back().first;
+            }
+        }
+        std::ranges::sort(points);
+    }
+
+    // The first point clockwise from the key's hash; empty when no nodes.
+    const std::string& owner(std::string_view key) const {
+        static const std::string none;
+        if (points.empty()) {
+            return none;
+        }
+        std::uint64_t hash = stable_hash(key);
+        auto it = std::ranges::lower_bound(points, hash, {}, &std::pair<std::uint64_t, std::string>::first);
+        return it != points.end() ? it->second : points.front().second;
+    }
+
+private:
+    std::vector<std::pair<std::uint64_t, std::string>> points;
+};
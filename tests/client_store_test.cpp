@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <format>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "memory_harness.hpp"
+
+// Removal from the indexed stores: every client left after an erase must
+// still be found where the store moved it, whatever order clients leave in.
+
+namespace {
+
+template<typename Index>
+void erase_in_any_order(std::string_view name, const std::vector<int>& sockets) {
+    IndexedClientStore<int, Index> store;
+    for (int socket : sockets) {
+        store.emplace_back(socket, Nickname{std::format("user{}", socket)});
+    }
+
+    std::vector<int> leaving = sockets;
+    std::ranges::shuffle(leaving, std::mt19937{42});
+    std::vector<int> remaining = sockets;
+    bool all_found = true;
+    for (int socket : leaving) {
+        store.erase(socket);
+        std::erase(remaining, socket);
+        all_found = all_found && !store.find(socket);
+        for (int other : remaining) {
+            auto client = store.find(other);
+            all_found = all_found && client && client->socket == other &&
+                        client->nickname.view() == std::format("user{}", other);
+        }
+        all_found = all_found && store.size() == remaining.size();
+    }
+    check(all_found, std::format("{}: every remaining client found after each erase", name));
+
+    store.erase(sockets.front());
+    check(store.size() == 0, std::format("{}: erasing a missing client changes nothing", name));
+}
+
+// Sockets a power of two apart share a home slot, so erasing from the middle
+// of a probe run must shift the rest back.
+void indexes_survive_any_order() {
+    std::vector<int> dense;
+    for (int fd = 3; fd < 503; ++fd) dense.push_back(fd);
+    erase_in_any_order<FdIndex<int>>("FdIndex", dense);
+    erase_in_any_order<OpenAddressingIndex<int>>("OpenAddressingIndex", dense);
+
+    std::vector<int> colliding;
+    for (int i = 0; i < 200; ++i) colliding.push_back((1 << 20) + i * 1024);
+    erase_in_any_order<OpenAddressingIndex<int>>("OpenAddressingIndex collisions", colliding);
+}
+
+// A mass disconnect through a server using the indexed store: everyone is
+// removed, and the one client left is still served.
+void mass_disconnect() {
+    MemoryTransport net;
+    ServerOptions options;
+    options.quiet = true;
+    ChatServer<int, IndexedClientStore<int, OpenAddressingIndex<int>>, MemoryTransport> server{options, net};
+    auto settle = [&] {
+        while (server.run_once() > 0) {
+        }
+    };
+
+    std::vector<int> clients;
+    for (int i = 0; i < 300; ++i) {
+        int fd = net.connect(options.port);
+        settle();
+        net.deliver(fd, std::format("user{}\r\n", i));
+        settle();
+        clients.push_back(fd);
+    }
+    int survivor = clients[150];
+    for (int fd : clients) {
+        if (fd != survivor) net.hang_up(fd);
+    }
+    settle();
+    for (int fd : clients) {
+        net.take_output(fd);
+    }
+
+    int late = net.connect(options.port);
+    settle();
+    net.deliver(late, "late\r\n");
+    settle();
+    check(net.take_output(late).contains("1 users online.\r\n👥 Users: user150\r\n"),
+          "departed clients are gone from the list");
+    check(net.take_output(survivor).contains("late joined the chat"), "the remaining client is still served");
+}
+
+} // namespace
+
+int main() {
+    indexes_survive_any_order();
+    mass_disconnect();
+    return finish("client_store_test");
+}
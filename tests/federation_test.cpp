@@ -0,0 +1,163 @@
+#include <array>
+#include <chrono>
+#include <format>
+#include <string>
+
+#include "memory_harness.hpp"
+#include "ring.hpp"
+
+// Linked nodes over MemoryTransport: the ring, chat and nicknames across
+// links, rooms owned on the ring, and what happens to them when the ring
+// changes.
+
+namespace {
+
+// Placement depends only on the node names, and a new node takes rooms only
+// for itself, roughly its share of them.
+void ring_places_consistently() {
+    std::array<std::string, 2> two{"a", "b"};
+    std::array<std::string, 2> swapped{"b", "a"};
+    std::array<std::string, 3> three{"a", "b", "c"};
+    HashRing before;
+    HashRing reordered;
+    HashRing after;
+    before.rebuild(two);
+    reordered.rebuild(swapped);
+    after.rebuild(three);
+
+    HashRing empty;
+    check(empty.owner("room").empty(), "an empty ring owns nothing");
+
+    constexpr int rooms = 3000;
+    int moved = 0;
+    int stray = 0;
+    int on_a = 0;
+    for (int i = 0; i < rooms; ++i) {
+        std::string name = std::format("room{}", i);
+        check(before.owner(name) == reordered.owner(name), "node order does not change placement");
+        if (before.owner(name) == "a") ++on_a;
+        if (before.owner(name) != after.owner(name)) {
+            ++moved;
+            if (after.owner(name) != "c") ++stray;
+        }
+    }
+    check(stray == 0, "rooms only move to the new node");
+    check(moved > rooms / 5 && moved < rooms / 2, "the new node takes about a third of the rooms");
+    check(on_a > rooms / 3 && on_a < rooms * 2 / 3, "two nodes split the rooms about evenly");
+}
+
+// Lobby lines, joins and departures cross a link.
+void lobby_spans_nodes() {
+    Cluster cluster;
+    Node& a = cluster.add("a", 5000);
+    Node& b = cluster.add("b", 5001);
+    cluster.link(a, b);
+
+    int alice = cluster.join(a, "alice");
+    int bob = cluster.join(b, "bob");
+    check(a.read(alice).contains("bob joined the chat"), "a heard of b's join");
+
+    cluster.say(a, alice, "hello from a");
+    check(b.read(bob).contains("alice: hello from a"), "line crossed the link");
+    check(a.read(alice).empty(), "sender was not sent its own line back");
+
+    b.net.hang_up(bob);
+    cluster.settle();
+    check(a.read(alice).contains("bob left the chat"), "a heard of b's departure");
+}
+
+
+// A room a owns while only a and b are linked, which moves to c once c links.
+std::string room_moving_to_c() {
+    std::array<std::string, 2> two{"a", "b"};
+    std::array<std::string, 3> three{"a", "b", "c"};
+    HashRing before;
+    HashRing after;
+    before.rebuild(two);
+    after.rebuild(three);
+    for (int i = 0;; ++i) {
+        std::string name = std::format("room{}", i);
+        if (before.owner(name) == "a" && after.owner(name) == "c") {
+            return name;
+        }
+    }
+}
+
+// The owner holds a batched line for a room with no local members when the
+// room moves away; forgetting the room must forget the held line too.
+void relink_while_room_batch_held() {
+    Cluster cluster;
+    ServerOptions batched;
+    batched.batch_window = std::chrono::seconds{3};
+    Node& a = cluster.add("a", 5000, batched);
+    Node& b = cluster.add("b", 5001);
+    Node& c = cluster.add("c", 5002);
+    cluster.link(a, b);
+
+    std::string room = room_moving_to_c();
+    int alice = cluster.join(b, "alice");
+    int bob = cluster.join(b, "bob");
+    cluster.say(b, alice, "/join " + room);
+    cluster.say(b, bob, "/join " + room);
+    b.read(alice);
+    b.read(bob);
+
+    cluster.say(b, alice, "before the move");
+    check(b.read(bob).contains("alice: before the move"), "line through the owner reached the member node");
+
+    cluster.link(a, c);
+    cluster.link(b, c);
+    cluster.say(b, alice, "after the move");
+    check(b.read(bob).contains("alice: after the move"), "line through the new owner reached the member node");
+}
+
+// A nickname is held once across the cluster, even when two nodes are
+// asked for it at the same moment.
+void nicknames_unique_across_nodes() {
+    Cluster cluster;
+    Node& a = cluster.add("a", 5000);
+    Node& b = cluster.add("b", 5001);
+    Node& c = cluster.add("c", 5002);
+    cluster.link(a, b);
+    cluster.link(a, c);
+    cluster.link(b, c);
+
+    int alice = cluster.join(a, "alice");
+    int impostor = b.net.connect(b.options.port);
+    cluster.settle();
+    b.read(impostor);
+    cluster.say(b, impostor, "alice");
+    check(b.read(impostor).contains("Nickname taken"), "a name held on a is refused on b");
+
+    // Leaving keeps the lease cached on a: a comes back without asking, and
+    // b still cannot have the name.
+    a.net.hang_up(alice);
+    cluster.settle();
+    cluster.say(b, impostor, "alice");
+    check(b.read(impostor).contains("Nickname taken"), "a cached lease still holds the name");
+    int again = a.net.connect(a.options.port);
+    cluster.settle();
+    cluster.say(a, again, "alice");
+    check(a.read(again).contains("Welcome"), "the lease lets the name back in on its node");
+
+    int on_b = b.net.connect(b.options.port);
+    int on_c = c.net.connect(c.options.port);
+    cluster.settle();
+    b.read(on_b);
+    c.read(on_c);
+    b.net.deliver(on_b, "zed\r\n");
+    c.net.deliver(on_c, "zed\r\n");
+    cluster.settle();
+    int welcomed = static_cast<int>(b.read(on_b).contains("Welcome")) + static_cast<int>(c.read(on_c).contains("Welcome"));
+    check(welcomed == 1, "exactly one of two simultaneous claims wins");
+}
+
+} // namespace
+
+int main() {
+    ring_places_consistently();
+    lobby_spans_nodes();
+    relink_while_room_batch_held();
+    nicknames_unique_across_nodes();
+    return finish("federation_test");
+}
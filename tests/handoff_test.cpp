@@ -0,0 +1,177 @@
+#include <array>
+#include <csignal>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "handoff.hpp"
+#include "memory_harness.hpp"
+
+// The handoff stream over a real SOCK_SEQPACKET pair, with pipes standing in
+// for the connections: the successor keeps either every descriptor or none.
+
+namespace {
+
+struct Channel {
+    std::array<int, 2> ends{-1, -1};
+
+    Channel() { socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, ends.data()); }
+    ~Channel() {
+        for (int fd : ends) {
+            if (fd >= 0) close(fd);
+        }
+    }
+
+    int sender() const { return ends[0]; }
+    int receiver() const { return ends[1]; }
+    void hang_up() {
+        close(ends[0]);
+        ends[0] = -1;
+    }
+};
+
+struct Pipe {
+    std::array<int, 2> ends{-1, -1};
+
+    Pipe() { pipe(ends.data()); }
+    ~Pipe() {
+        for (int fd : ends) {
+            if (fd >= 0) close(fd);
+        }
+    }
+
+    // Gives up our copy of the read end, as the old server does on success.
+    int release_reader() {
+        int fd = ends[0];
+        ends[0] = -1;
+        return fd;
+    }
+
+    // False once nobody holds the read end any more.
+    bool has_reader() const { return write(ends[1], "x", 1) == 1; }
+};
+
+HandoffEntry client_entry(int fd, std::string_view nickname, std::string pending) {
+    HandoffEntry entry{{HandoffType::Client, 0, static_cast<std::uint8_t>(nickname.size()), {}, 0}, fd,
+                       std::move(pending)};
+    std::memcpy(entry.record.nickname, nickname.data(), nickname.size());
+    return entry;
+}
+
+bool throws(auto&& call) {
+    try {
+        call();
+    } catch (const std::exception&) {
+        return true;
+    }
+    return false;
+}
+
+void round_trip() {
+    Channel channel;
+    Pipe listener;
+    Pipe alice;
+    std::vector<HandoffEntry> entries{
+        {{HandoffType::Listener, 0, 0, {}, 0}, listener.ends[0], {}},
+        client_entry(alice.ends[0], "alice", "half a li"),
+    };
+    send_handoff(channel.sender(), entries);
+    channel.hang_up();
+
+    std::vector<HandoffEntry> received = receive_handoff(channel.receiver());
+    check(received.size() == 2, "both entries arrive");
+    if (received.size() != 2) return;
+    check(received[0].record.type == HandoffType::Listener, "listener keeps its type");
+    check(std::string_view{received[1].record.nickname, received[1].record.nickname_length} == "alice",
+          "client keeps its nickname");
+    check(received[1].pending == "half a li", "unread input follows its client");
+
+    close(listener.release_reader());
+    close(alice.release_reader());
+    char byte = 0;
+    check(alice.has_reader() && read(received[1].fd, &byte, 1) == 1 && byte == 'x',
+          "received descriptor reads what the old one would have");
+    for (const auto& entry : received) {
+        close(entry.fd);
+    }
+}
+
+void refusal_is_empty() {
+    Channel channel;
+    channel.hang_up();
+    check(receive_handoff(channel.receiver()).empty(), "a channel closed before the begin marker is a refusal");
+}
+
+void oversized_input_sends_nothing() {
+    Channel channel;
+    Pipe alice;
+    std::vector<HandoffEntry> entries{client_entry(alice.ends[0], "alice", std::string(HANDOFF_MAX_PENDING + 1, 'a'))};
+    bool broken = false;
+    bool refused = false;
+    try {
+        send_handoff(channel.sender(), entries);
+    } catch (const HandoffBroken&) {
+        broken = true;
+    } catch (const std::exception&) {
+        refused = true;
+    }
+    check(refused && !broken, "oversized pending input is refused before any descriptor leaves");
+    channel.hang_up();
+    check(receive_handoff(channel.receiver()).empty(), "refused handoff sent nothing");
+}
+
+void missing_commit_keeps_nothing() {
+    Channel channel;
+    Pipe alice;
+    std::vector<HandoffEntry> entries{client_entry(alice.ends[0], "alice", "")};
+    send_handoff_marker(channel.sender(), HANDOFF_BEGIN, entries.size());
+    send_handoff_records(channel.sender(), entries);
+    channel.hang_up();
+    close(alice.release_reader());
+
+    check(throws([&] { receive_handoff(channel.receiver()); }), "stream without a commit is an error");
+    check(!alice.has_reader(), "descriptors from an uncommitted stream are closed");
+}
+
+void commit_count_must_match() {
+    Channel channel;
+    Pipe alice;
+    std::vector<HandoffEntry> entries{client_entry(alice.ends[0], "alice", "")};
+    send_handoff_marker(channel.sender(), HANDOFF_BEGIN, entries.size());
+    send_handoff_records(channel.sender(), entries);
+    send_handoff_marker(channel.sender(), HANDOFF_COMMIT, entries.size() + 1);
+    channel.hang_up();
+    close(alice.release_reader());
+
+    check(throws([&] { receive_handoff(channel.receiver()); }), "commit for a different count is an error");
+    check(!alice.has_reader(), "descriptors behind a mismatched commit are closed");
+}
+
+void short_stream_is_rejected() {
+    Channel channel;
+    Pipe alice;
+    std::vector<HandoffEntry> entries{client_entry(alice.ends[0], "alice", "")};
+    send_handoff_marker(channel.sender(), HANDOFF_BEGIN, 2);
+    send_handoff_records(channel.sender(), entries);
+    send_handoff_marker(channel.sender(), HANDOFF_COMMIT, 2);
+    channel.hang_up();
+    close(alice.release_reader());
+
+    check(throws([&] { receive_handoff(channel.receiver()); }), "fewer records than announced is an error");
+    check(!alice.has_reader(), "descriptors from a short stream are closed");
+}
+
+} // namespace
+
+int main() {
+    std::signal(SIGPIPE, SIG_IGN);
+    round_trip();
+    refusal_is_empty();
+    oversized_input_sends_nothing();
+    missing_commit_keeps_nothing();
+    commit_count_must_match();
+    short_stream_is_rejected();
+    return finish("handoff_test");
+}
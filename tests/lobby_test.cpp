@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "memory_harness.hpp"
+
+// The lobby over MemoryTransport: who hears of a departure and when, the
+// order batched lines go out in, and what binary input may put in front of
+// text clients.
+
+namespace {
+
+// A client dropped for a bad frame can still read; it must not be told of
+// its own departure, while everyone else is.
+void leaver_not_told() {
+    Node node{ServerOptions{}};
+    int alice = node.join("alice");
+    int bot = node.join_binary("bot");
+    // Keeps binary output rendered after bot is no longer counted.
+    int other = node.join_binary("other");
+    node.read(alice);
+    node.read(bot);
+
+    std::string oversized;
+    append_frame_header(oversized, FrameType::Chat, 0, MAX_FRAME_PAYLOAD + 1);
+    node.send_bytes(bot, oversized);
+
+    check(node.net.closed(bot), "invalid frame closed the connection");
+    for (const auto& frame : frames_in(node.read(bot))) {
+        check(frame.type != FrameType::Leave, "leaver was sent its own leave");
+    }
+    check(node.read(alice).contains("bot left the chat"), "others heard of the departure");
+    auto heard = frames_in(node.read(other));
+    check(!heard.empty() && heard.back().type == FrameType::Leave, "binary clients heard of the departure");
+}
+
+// Binary input skips the line splitter, so CR, LF and other control
+// characters must be refused before they reach a text client's line.
+void binary_input_cannot_forge_lines() {
+    Node node{ServerOptions{}};
+    int alice = node.join("alice");
+    int bot = node.join({});
+    node.say(bot, BINARY_HANDSHAKE);
+    node.read(bot);
+
+    for (std::string_view name : {std::string_view{"bot\r\n👋 admin joined the chat"}, std::string_view{},
+                                  std::string_view{"b\0t", 3}}) {
+        node.send_bytes(bot, frame_bytes(FrameType::Nick, name));
+        auto replies = frames_in(node.read(bot));
+        check(replies.size() == 1 && replies[0].type == FrameType::Error, "bad nickname answered with an error");
+    }
+    check(node.read(alice).empty(), "nobody heard of a bad nickname");
+
+    node.send_bytes(bot, frame_bytes(FrameType::Nick, "bot"));
+    node.read(bot);
+    node.read(alice);
+    for (std::string_view line : {"hi\r\n💬 admin: give me your password", "", "bell\a"}) {
+        node.send_bytes(bot, frame_bytes(FrameType::Chat, line));
+        auto replies = frames_in(node.read(bot));
+        check(replies.size() == 1 && replies[0].type == FrameType::Error, "bad chat line answered with an error");
+    }
+    check(node.read(alice).empty(), "no bad chat line was broadcast");
+
+    node.send_bytes(bot, frame_bytes(FrameType::Chat, "hello"));
+    check(node.read(alice) == "💬 bot: hello\r\n", "a clean chat line still goes out");
+}
+
+// A room name is echoed into members' join and leave lines.
+void room_names_stay_printable() {
+    Node node{ServerOptions{}};
+    int alice = node.join("alice");
+    node.say(alice, "/join r");
+    node.read(alice);
+    int bot = node.join_binary("bot");
+
+    node.send_bytes(bot, frame_bytes(FrameType::RoomJoin, "r\n💬 admin: hi"));
+    auto replies = frames_in(node.read(bot));
+    check(replies.size() == 1 && replies[0].type == FrameType::Error, "bad room name answered with an error");
+    check(node.read(alice).empty(), "room members heard nothing of a bad room name");
+
+    node.send_bytes(bot, frame_bytes(FrameType::RoomJoin, "r"));
+    check(node.read(alice) == "👋 bot joined #r\r\n", "a clean room name still joins");
+}
+
+// Windows are real time; MemoryTransport never blocks, so the test waits
+// them out and lets the server notice.
+void wait_out(Node& node, std::chrono::microseconds window) {
+    std::this_thread::sleep_for(window + std::chrono::milliseconds{5});
+    node.server->run_once();
+    node.settle();
+}
+
+// Several departures within the window are one line for text clients and
+// a Leave frame per name, in one send, for binary ones.
+void departures_coalesce() {
+    ServerOptions options;
+    options.departure_window = std::chrono::milliseconds{20};
+    Node node{options};
+    int alice = node.join("alice");
+    int bot = node.join_binary("bot");
+    int carol = node.join("carol");
+    int dave = node.join("dave");
+    int erin = node.join("erin");
+    node.read(alice);
+    node.read(bot);
+
+    node.net.hang_up(carol);
+    node.net.hang_up(dave);
+    node.net.hang_up(erin);
+    node.settle();
+    check(node.read(alice).empty(), "departures wait for the window");
+
+    wait_out(node, options.departure_window);
+    check(node.read(alice) == "👋 3 users left the chat: carol, dave, erin\r\n", "three departures are one line");
+    auto frames = frames_in(node.read(bot));
+    check(frames.size() == 3 && std::ranges::all_of(frames, [](const Frame& f) { return f.type == FrameType::Leave; }),
+          "binary clients get a Leave frame per name");
+}
+
+// A join inside the window is heard after the departures before it.
+void join_flushes_departures() {
+    ServerOptions options;
+    options.departure_window = std::chrono::seconds{60};
+    Node node{options};
+    int alice = node.join("alice");
+    int bob = node.join("bob");
+    node.read(alice);
+
+    node.net.hang_up(bob);
+    node.settle();
+    node.join("bob");
+    std::string heard = node.read(alice);
+    check(heard.contains("bob left the chat") && heard.contains("bob joined the chat") &&
+              heard.find("left") < heard.find("joined"),
+          "bob left before bob came back");
+}
+
+// Batched lines keep their order, and a sender's copy leaves out its own.
+void batch_keeps_order() {
+    ServerOptions options;
+    options.batch_window = std::chrono::milliseconds{20};
+    Node node{options};
+    int alice = node.join("alice");
+    int bob = node.join("bob");
+    int carol = node.join("carol");
+    wait_out(node, options.batch_window);
+    node.read(alice);
+    node.read(bob);
+    node.read(carol);
+
+    node.say(alice, "one");
+    node.say(bob, "two");
+    node.say(alice, "three");
+    check(node.read(carol).empty(), "lines wait for the window");
+
+    wait_out(node, options.batch_window);
+    check(node.read(carol) == "💬 alice: one\r\n💬 bob: two\r\n💬 alice: three\r\n", "lines arrive in order");
+    check(node.read(alice) == "💬 bob: two\r\n", "sender skips its own lines");
+    check(node.read(bob) == "💬 alice: one\r\n💬 alice: three\r\n", "each sender skips only its own");
+}
+
+// Rooms hold their departures the same way, and their next line waits
+// until the departures are out.
+void room_departures_coalesce() {
+    ServerOptions options;
+    options.departure_window = std::chrono::seconds{60};
+    Node node{options};
+    int alice = node.join("alice");
+    int bob = node.join("bob");
+    int carol = node.join("carol");
+    for (int fd : {alice, bob, carol}) {
+        node.say(fd, "/join r");
+    }
+    node.read(alice);
+
+    node.net.hang_up(bob);
+    node.say(carol, "/leave");
+    check(node.read(alice).empty(), "room departures wait for the window");
+
+    int erin = node.join("erin");
+    node.say(erin, "/join r");
+    check(node.read(alice) == "👋 2 users left #r: bob, carol\r\n👋 erin joined #r\r\n",
+          "room departures are one line, before the next join");
+}
+
+} // namespace
+
+int main() {
+    leaver_not_told();
+    binary_input_cannot_forge_lines();
+    room_names_stay_printable();
+    departures_coalesce();
+    join_flushes_departures();
+    batch_keeps_order();
+    room_departures_coalesce();
+    return finish("lobby_test");
+}
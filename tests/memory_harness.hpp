@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstdlib>
+#include <memory>
+#include <print>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "chat_server.hpp"
+#include "client_store.hpp"
+#include "config.hpp"
+#include "protocol.hpp"
+#include "transport.hpp"
+
+// Drives servers over MemoryTransport: no sockets, no timing, and every
+// byte a client was sent can be read back. Peer links are two accepted
+// connections, one on each node's peer port, whose output the harness
+// copies across.
+
+inline int failures = 0;
+
+inline void check(bool ok, std::string_view what) {
+    if (!ok) {
+        std::print(stderr, "FAIL: {}\n", what);
+        ++failures;
+    }
+}
+
+inline int finish(std::string_view name) {
+    if (failures > 0) {
+        std::print(stderr, "{}: {} checks failed\n", name, failures);
+        return EXIT_FAILURE;
+    }
+    std::print("{}: all checks passed\n", name);
+    return EXIT_SUCCESS;
+}
+
+// Splits what a binary client was sent; the frames view into bytes.
+inline std::vector<Frame> frames_in(std::string_view bytes) {
+    std::vector<Frame> frames;
+    Frame frame;
+    size_t consumed = 0;
+    while (parse_frame(bytes, frame, consumed) == ParseStatus::Complete) {
+        frames.push_back(frame);
+        bytes.remove_prefix(consumed);
+    }
+    return frames;
+}
+
+inline std::string frame_bytes(FrameType type, std::string_view payload) {
+    std::string out;
+    append_frame(out, type, 0, payload);
+    return out;
+}
+
+using MemoryServer = ChatServer<int, ClientStore<int>, MemoryTransport>;
+
+struct Node {
+    MemoryTransport net;
+    ServerOptions options;
+    std::unique_ptr<MemoryServer> server;
+
+    explicit Node(ServerOptions opts) : options(std::move(opts)) {
+        options.quiet = true;
+        server = std::make_unique<MemoryServer>(options, net);
+    }
+
+    void settle() {
+        while (server->run_once() > 0) {
+        }
+    }
+
+    // Connects and, unless nickname is empty, registers as a text client.
+    int join(std::string_view nickname) {
+        int fd = net.connect(options.port);
+        settle();
+        if (!nickname.empty()) {
+            say(fd, nickname);
+            net.take_output(fd);
+        }
+        return fd;
+    }
+
+    // Switches to the binary protocol and registers with a Nick frame.
+    int join_binary(std::string_view nickname) {
+        int fd = join({});
+        say(fd, BINARY_HANDSHAKE);
+        send_bytes(fd, frame_bytes(FrameType::Nick, nickname));
+        net.take_output(fd);
+        return fd;
+    }
+
+    void say(int fd, std::string_view line) {
+        net.deliver(fd, std::string{line} + "\r\n");
+        settle();
+    }
+
+    void send_bytes(int fd, std::string_view bytes) {
+        net.deliver(fd, bytes);
+        settle();
+    }
+
+    std::string read(int fd) { return net.take_output(fd); }
+};
+
+struct Link {
+    Node* a;
+    int a_fd;
+    Node* b;
+    int b_fd;
+};
+
+class Cluster {
+public:
+    Node& add(std::string name, std::uint16_t port, ServerOptions options = {}) {
+        options.node_name = std::move(name);
+        options.port = port;
+        options.peer_port = static_cast<std::uint16_t>(port + 1000);
+        nodes.push_back(std::make_unique<Node>(options));
+        return *nodes.back();
+    }
+
+    void link(Node& a, Node& b) {
+        links.push_back({&a, a.net.connect(a.options.peer_port), &b, b.net.connect(b.options.peer_port)});
+        settle();
+    }
+
+    // Until no node has anything left to read and no link anything to carry.
+    void settle() {
+        bool moved = true;
+        while (moved) {
+            moved = false;
+            for (auto& node : nodes) {
+                while (node->server->run_once() > 0) {
+                    moved = true;
+                }
+            }
+            for (auto& link : links) {
+                if (std::string out = link.a->net.take_output(link.a_fd); !out.empty()) {
+                    link.b->net.deliver(link.b_fd, out);
+                    moved = true;
+                }
+                if (std::string out = link.b->net.take_output(link.b_fd); !out.empty()) {
+                    link.a->net.deliver(link.a_fd, out);
+                    moved = true;
+                }
+            }
+        }
+    }
+
+    int join(Node& node, std::string_view nickname) {
+        int fd = node.net.connect(node.options.port);
+        settle();
+        say(node, fd, nickname);
+        node.read(fd);
+        return fd;
+    }
+
+    void say(Node& node, int fd, std::string_view line) {
+        node.net.deliver(fd, std::string{line} + "\r\n");
+        settle();
+    }
+
+private:
+    std::vector<std::unique_ptr<Node>> nodes;
+    std::vector<Link> links;
+};
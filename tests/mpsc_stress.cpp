@@ -0,0 +1,92 @@
+#include <poll.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <print>
+#include <thread>
+#include <vector>
+
+#include "mpsc_queue.hpp"
+
+// Producers hammer a small Mailbox while one consumer sleeps on its eventfd
+// like the event loop does. Every message must arrive exactly once, and each
+// producer's messages in the order it posted them.
+
+namespace {
+
+constexpr size_t PRODUCERS = 8;
+constexpr std::uint64_t PER_PRODUCER = 200'000;
+// Small enough that producers regularly find the queue full.
+constexpr size_t CAPACITY = 64;
+
+struct Message {
+    std::uint32_t producer = 0;
+    std::uint64_t sequence = 0;
+};
+
+int failures = 0;
+
+void check(bool ok, std::string_view what) {
+    if (!ok) {
+        std::print(stderr, "FAIL: {}\n", what);
+        ++failures;
+    }
+}
+
+void stress_mailbox() {
+    Mailbox<Message> mailbox(CAPACITY);
+    std::vector<std::jthread> producers;
+    for (std::uint32_t p = 0; p < PRODUCERS; ++p) {
+        producers.emplace_back([&mailbox, p] {
+            for (std::uint64_t i = 0; i < PER_PRODUCER; ++i) {
+                while (!mailbox.post({p, i})) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    std::vector<std::uint64_t> next(PRODUCERS, 0);
+    std::uint64_t received = 0;
+    bool ordered = true;
+    while (received < PRODUCERS * PER_PRODUCER) {
+        // A lost wakeup shows up as this poll timing out with work queued.
+        pollfd pfd{mailbox.fd(), POLLIN, 0};
+        if (poll(&pfd, 1, 5'000) <= 0) {
+            check(false, "mailbox stopped waking the consumer");
+            return;
+        }
+        received += mailbox.drain([&](Message message) {
+            ordered = ordered && message.sequence == next[message.producer];
+            ++next[message.producer];
+        });
+    }
+
+    check(ordered, "a producer's messages arrived out of order");
+    check(received == PRODUCERS * PER_PRODUCER, "message count differs from what was posted");
+    for (std::uint64_t count : next) {
+        check(count == PER_PRODUCER, "a producer lost or duplicated messages");
+    }
+}
+
+void full_queue_rejects() {
+    MpscQueue<int> queue(4);
+    for (int i = 0; i < static_cast<int>(queue.capacity()); ++i) {
+        check(queue.try_push(i), "push into a queue with room failed");
+    }
+    check(!queue.try_push(-1), "push into a full queue succeeded");
+    check(queue.try_pop() == 0, "pop did not return the oldest value");
+    check(queue.try_push(4), "push after a pop failed");
+}
+
+} // namespace
+
+int main() {
+    full_queue_rejects();
+    stress_mailbox();
+    if (failures > 0) {
+        return EXIT_FAILURE;
+    }
+    std::print("mpsc_stress: {} messages from {} producers, all in order\n", PRODUCERS * PER_PRODUCER, PRODUCERS);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "memory_harness.hpp"
+#include "websocket.hpp"
+
+// Binary frames and the WebSocket gateway: the parsers on their own, then
+// the same input arriving at a server over MemoryTransport.
+
+namespace {
+
+std::string masked_frame(WebSocketOpcode opcode, std::string_view payload) {
+    constexpr std::uint8_t mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+    std::string out;
+    append_websocket_frame_header(out, opcode, payload.size());
+    out[1] = static_cast<char>(out[1] | 0x80);
+    out.append(reinterpret_cast<const char*>(mask), 4);
+    size_t start = out.size();
+    out += payload;
+    unmask(out.data() + start, payload.size(), mask);
+    return out;
+}
+
+// Payloads of the unmasked frames a server sent; stops at anything partial.
+std::vector<std::string> server_frames(std::string_view bytes) {
+    std::vector<std::string> payloads;
+    while (bytes.size() >= 2) {
+        size_t header = 2;
+        size_t length = static_cast<std::uint8_t>(bytes[1]) & 0x7F;
+        if (length == 126) {
+            if (bytes.size() < 4) break;
+            length = static_cast<size_t>(static_cast<std::uint8_t>(bytes[2]) << 8 | static_cast<std::uint8_t>(bytes[3]));
+            header = 4;
+        }
+        if (bytes.size() < header + length) break;
+        payloads.emplace_back(bytes.substr(header, length));
+        bytes.remove_prefix(header + length);
+    }
+    return payloads;
+}
+
+bool any_contains(const std::vector<std::string>& payloads, std::string_view text) {
+    return std::ranges::any_of(payloads, [text](const std::string& p) { return p.contains(text); });
+}
+
+void binary_frames_parse() {
+    std::string two = frame_bytes(FrameType::Nick, "bot") + frame_bytes(FrameType::Chat, "hello");
+    Frame frame;
+    size_t consumed = 0;
+
+    check(parse_frame(std::string_view{two}.substr(0, FRAME_HEADER_SIZE - 1), frame, consumed) ==
+              ParseStatus::Incomplete,
+          "partial header is incomplete");
+    check(parse_frame(std::string_view{two}.substr(0, FRAME_HEADER_SIZE + 1), frame, consumed) ==
+              ParseStatus::Incomplete,
+          "partial payload is incomplete");
+    check(parse_frame(two, frame, consumed) == ParseStatus::Complete && frame.type == FrameType::Nick &&
+              frame.payload == "bot" && consumed == FRAME_HEADER_SIZE + 3,
+          "first of two frames parses alone");
+    auto frames = frames_in(two);
+    check(frames.size() == 2 && frames[1].payload == "hello", "back-to-back frames both parse");
+
+    std::string oversized;
+    append_frame_header(oversized, FrameType::Chat, 0, MAX_FRAME_PAYLOAD + 1);
+    check(parse_frame(oversized, frame, consumed) == ParseStatus::Invalid,
+          "oversized length is invalid before its payload arrives");
+    std::string largest;
+    append_frame(largest, FrameType::Chat, 0, std::string(MAX_FRAME_PAYLOAD, 'x'));
+    check(parse_frame(largest, frame, consumed) == ParseStatus::Complete, "largest allowed payload parses");
+}
+
+// Input split at every byte still makes whole frames; a bad one drops only
+// its sender.
+void binary_frames_over_server() {
+    Node node{ServerOptions{}};
+    int alice = node.join("alice");
+    int bot = node.join({});
+    node.say(bot, BINARY_HANDSHAKE);
+    node.read(bot);
+
+    std::string input = frame_bytes(FrameType::Nick, "bot") + frame_bytes(FrameType::Chat, "one byte at a time");
+    for (char byte : input) {
+        node.send_bytes(bot, std::string_view{&byte, 1});
+    }
+    check(node.read(alice).contains("💬 bot: one byte at a time"), "frames split at every byte still arrive");
+    auto replies = frames_in(node.read(bot));
+    check(!replies.empty() && replies[0].type == FrameType::Welcome, "split Nick frame registered the client");
+
+    std::string oversized;
+    append_frame_header(oversized, FrameType::Chat, 0, MAX_FRAME_PAYLOAD + 1);
+    node.send_bytes(bot, oversized);
+    check(node.net.closed(bot), "oversized frame closed its sender");
+    check(!node.net.closed(alice), "other clients stayed connected");
+}
+
+void upgrade_request_parses() {
+    std::string accept;
+    size_t consumed = 0;
+    constexpr std::string_view request = "GET /chat HTTP/1.1\r\n"
+                                         "Host: server.example.com\r\n"
+                                         "Upgrade: websocket\r\n"
+                                         "sec-websocket-key:  dGhlIHNhbXBsZSBub25jZQ== \r\n"
+                                         "\r\n";
+    check(parse_upgrade_request(request, accept, consumed) == ParseStatus::Complete &&
+              accept == "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=" && consumed == request.size(),
+          "RFC 6455 sample key gives the sample accept value");
+    check(parse_upgrade_request(request.substr(0, 30), accept, consumed) == ParseStatus::Incomplete,
+          "unfinished request is incomplete");
+    check(parse_upgrade_request("GET / HTTP/1.1\r\nHost: x\r\n\r\n", accept, consumed) == ParseStatus::Invalid,
+          "request without a key is invalid");
+    check(parse_upgrade_request("POST / HTTP/1.1\r\nSec-WebSocket-Key: a\r\n\r\n", accept, consumed) ==
+              ParseStatus::Invalid,
+          "only GET upgrades");
+    check(parse_upgrade_request(std::string(MAX_UPGRADE_REQUEST + 1, 'a'), accept, consumed) == ParseStatus::Invalid,
+          "endless headers are invalid");
+}
+
+void websocket_frames_parse() {
+    WebSocketFrame frame;
+    size_t consumed = 0;
+
+    std::string hello = masked_frame(WebSocketOpcode::Text, "Hello");
+    check(parse_websocket_frame(hello, frame, consumed) == ParseStatus::Complete && frame.fin &&
+              frame.opcode == WebSocketOpcode::Text && frame.payload == "Hello" && consumed == hello.size(),
+          "masked frame unmasks in place");
+
+    std::string medium = masked_frame(WebSocketOpcode::Binary, std::string(300, 'm'));
+    check(parse_websocket_frame(std::span<char>{medium}.first(medium.size() - 1), frame, consumed) ==
+              ParseStatus::Incomplete,
+          "16-bit length frame waits for its last byte");
+    check(parse_websocket_frame(medium, frame, consumed) == ParseStatus::Complete && frame.payload.size() == 300,
+          "16-bit length frame parses");
+
+    std::string unmasked;
+    append_websocket_frame(unmasked, WebSocketOpcode::Text, "hi");
+    check(parse_websocket_frame(unmasked, frame, consumed) == ParseStatus::Invalid, "unmasked client frame is invalid");
+
+    std::string reserved = masked_frame(WebSocketOpcode::Text, "hi");
+    reserved[0] = static_cast<char>(reserved[0] | 0x40);
+    check(parse_websocket_frame(reserved, frame, consumed) == ParseStatus::Invalid, "reserved bits are invalid");
+
+    std::string oversized;
+    append_websocket_frame_header(oversized, WebSocketOpcode::Text, MAX_FRAME_PAYLOAD + 1);
+    oversized[1] = static_cast<char>(oversized[1] | 0x80);
+    oversized.append(4, '\0');
+    check(parse_websocket_frame(oversized, frame, consumed) == ParseStatus::Invalid, "oversized frame is invalid");
+}
+
+void websocket_over_server() {
+    ServerOptions options;
+    options.websocket_port = 8080;
+    Node node{options};
+    int alice = node.join("alice");
+    int browser = node.net.connect(options.websocket_port);
+    node.settle();
+
+    node.send_bytes(browser, "GET / HTTP/1.1\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n");
+    std::string response = node.read(browser);
+    check(response.starts_with("HTTP/1.1 101") && response.contains("s3pPLMBiTxaQ9kYGzzhZRbK+xOo="),
+          "upgrade answered with the accept value");
+
+    node.send_bytes(browser, masked_frame(WebSocketOpcode::Text, "carol"));
+    check(any_contains(server_frames(node.read(browser)), "Welcome"), "nickname in a text frame registers");
+    node.read(alice);
+
+    // Two frames in one read, the second split across the next.
+    std::string two = masked_frame(WebSocketOpcode::Text, "first") + masked_frame(WebSocketOpcode::Text, "second");
+    node.send_bytes(browser, std::string_view{two}.substr(0, two.size() - 3));
+    node.send_bytes(browser, std::string_view{two}.substr(two.size() - 3));
+    std::string heard = node.read(alice);
+    check(heard.contains("carol: first") && heard.contains("carol: second") &&
+              heard.find("first") < heard.find("second"),
+          "frames reach the lobby whole and in order");
+
+    node.say(alice, "hi carol");
+    check(any_contains(server_frames(node.read(browser)), "alice: hi carol"), "lobby lines reach the browser as frames");
+
+    std::string unmasked;
+    append_websocket_frame(unmasked, WebSocketOpcode::Text, "hi");
+    node.send_bytes(browser, unmasked);
+    check(node.net.closed(browser), "unmasked frame closed the connection");
+    check(node.read(alice).contains("carol left the chat"), "lobby heard the browser leave");
+}
+
+} // namespace
+
+int main() {
+    binary_frames_parse();
+    binary_frames_over_server();
+    upgrade_request_parses();
+    websocket_frames_parse();
+    websocket_over_server();
+    return finish("protocol_test");
+}
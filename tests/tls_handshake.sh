@@ -0,0 +1,62 @@
+#!/bin/sh
+# Runs the TLS listener against a throwaway self-signed certificate. Two
+# s_client sessions register over TLS; the second one's chat line must reach
+# the first, so the handshake, decryption of input and the encrypted
+# broadcast path are all exercised. Prints whether kTLS took over.
+#
+# usage: tests/tls_handshake.sh path/to/server [tls-port]
+set -eu
+
+server=$1
+tls_port=${2:-39443}
+plain_port=$((tls_port + 1))
+dir=$(mktemp -d)
+server_pid=
+
+cleanup() {
+    [ -n "$server_pid" ] && kill "$server_pid" 2>/dev/null
+    rm -rf "$dir"
+}
+trap cleanup EXIT
+
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost \
+    -keyout "$dir/key.pem" -out "$dir/cert.pem" 2>/dev/null
+
+line_buffered=
+command -v stdbuf >/dev/null && line_buffered="stdbuf -oL"
+$line_buffered "$server" --port "$plain_port" --tls-port "$tls_port" \
+    --tls-cert "$dir/cert.pem" --tls-key "$dir/key.pem" >"$dir/server.log" 2>&1 &
+server_pid=$!
+
+for _ in 1 2 3 4 5 6 7 8 9 10; do
+    grep -q "TLS on" "$dir/server.log" 2>/dev/null && break
+    sleep 0.2
+done
+
+client() {
+    openssl s_client -connect "127.0.0.1:$tls_port" -servername localhost -quiet -no_ign_eof 2>"$dir/$1.err"
+}
+
+{ printf 'listener\r\n'; sleep 3; } | client listener >"$dir/listener.out" &
+listener_pid=$!
+sleep 1
+{ printf 'speaker\r\n'; sleep 0.5; printf 'hello over tls\r\n'; sleep 1; } | client speaker >"$dir/speaker.out"
+wait "$listener_pid" || true
+
+status=0
+if ! grep -q "Welcome" "$dir/speaker.out"; then
+    echo "FAIL: no welcome over TLS" >&2
+    status=1
+fi
+if ! grep -q "speaker: hello over tls" "$dir/listener.out"; then
+    echo "FAIL: chat line did not arrive over TLS" >&2
+    status=1
+fi
+
+if grep -q "kernel encryption" "$dir/server.log"; then
+    echo "tls_handshake: ok, kTLS encrypting"
+elif grep -q "user-space encryption" "$dir/server.log"; then
+    echo "tls_handshake: ok, user-space encryption (kTLS unavailable)"
+fi
+[ "$status" -eq 0 ] || cat "$dir/server.log" >&2
+exit "$status"
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#ifdef TCP_CHAT_HAVE_OPENSSL
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#endif
+
+enum class TlsStatus {
+    Done,
+    WantRead,
+    Failed,
+};
+
+#ifdef TCP_CHAT_HAVE_OPENSSL
+
+inline std::string tls_error() {
+    char text[256];
+    ERR_error_string_n(ERR_get_error(), text, sizeof(text));
+    return text;
+}
+
+// Server-side TLS settings shared by every connection on the TLS listener.
+// Ciphers are limited to the AES-GCM suites Linux kTLS can take over, and
+// session tickets are off so nothing but chat data is written after the
+// handshake.
+class TlsContext {
+public:
+    static constexpr bool available = true;
+
+    TlsContext(const std::string& cert_path, const std::string& key_path)
+        : context(SSL_CTX_new(TLS_server_method()), SSL_CTX_free) {
+        if (!context) {
+            throw std::runtime_error("SSL_CTX_new failed: " + tls_error());
+        }
+        SSL_CTX* ctx = context.get();
+        SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+        SSL_CTX_set_cipher_list(ctx, "ECDHE+AESGCM");
+        SSL_CTX_set_ciphersuites(ctx, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384");
+        SSL_CTX_set_num_tickets(ctx, 0);
+        if (SSL_CTX_use_certificate_chain_file(ctx, cert_path.c_str()) != 1) {
+            throw std::runtime_error("cannot load certificate " + cert_path + ": " + tls_error());
+        }
+        if (SSL_CTX_use_PrivateKey_file(ctx, key_path.c_str(), SSL_FILETYPE_PEM) != 1) {
+            throw std::runtime_error("cannot load private key " + key_path + ": " + tls_error());
+        }
+    }
+
+    SSL_CTX* get() const { return context.get(); }
+
+private:
+    std::unique_ptr<SSL_CTX, decltype(&SSL_CTX_free)> context;
+};
+
+// One connection's TLS state. Ciphertext read by the server is fed in
+// through a memory BIO, so the socket stays blocking for sends and a partial
+// record can never stall the event loop; writes go straight to the socket,
+// where OpenSSL switches on kTLS once the handshake completes. From then on
+// the kernel encrypts and plain send()/sendmsg() on the socket is enough.
+class TlsSession {
+public:
+    TlsSession(const TlsContext& context, int fd) : ssl(SSL_new(context.get()), SSL_free) {
+        if (!ssl) {
+            throw std::runtime_error("SSL_new failed: " + tls_error());
+        }
+        input = BIO_new(BIO_s_mem());
+        SSL_set_bio(ssl.get(), input, BIO_new_socket(fd, BIO_NOCLOSE));
+        SSL_set_accept_state(ssl.get());
+    }
+
+    void feed(std::string_view ciphertext) {
+        BIO_write(input, ciphertext.data(), static_cast<int>(ciphertext.size()));
+    }
+
+    TlsStatus handshake() {
+        int result = SSL_do_handshake(ssl.get());
+        if (result == 1) {
+            offloaded = BIO_get_ktls_send(SSL_get_wbio(ssl.get()));
+            return TlsStatus::Done;
+        }
+        return SSL_get_error(ssl.get(), result) == SSL_ERROR_WANT_READ ? TlsStatus::WantRead : TlsStatus::Failed;
+    }
+
+    // True once the kernel encrypts everything written to the socket.
+    bool kernel_send() const { return offloaded; }
+
+    // Appends all application data decrypted so far; false once the peer
+    // has closed the session or sent something undecryptable.
+    bool read_into(std::string& out) {
+        char plain[4096];
+        while (true) {
+            int bytes = SSL_read(ssl.get(), plain, sizeof(plain));
+            if (bytes > 0) {
+                out.append(plain, static_cast<size_t>(bytes));
+                continue;
+            }
+            return SSL_get_error(ssl.get(), bytes) == SSL_ERROR_WANT_READ;
+        }
+    }
+
+    // Encrypts in user space; only used when kTLS is unavailable.
+    bool write(std::string_view plain) {
+        return plain.empty() || SSL_write(ssl.get(), plain.data(), static_cast<int>(plain.size())) > 0;
+    }
+
+private:
+    std::unique_ptr<SSL, decltype(&SSL_free)> ssl;
+    BIO* input;
+    bool offloaded = false;
+};
+
+#else
+
+inline std::string tls_error() {
+    return "built without OpenSSL";
+}
+
+class TlsContext {
+public:
+    static constexpr bool available = false;
+
+    TlsContext(const std::string&, const std::string&) {
+        throw std::runtime_error("TLS support requires building with OpenSSL");
+    }
+};
+
+class TlsSession {
+public:
+    TlsSession(const TlsContext&, int) {}
+    void feed(std::string_view) {}
+    TlsStatus handshake() { return TlsStatus::Failed; }
+    bool kernel_send() const { return false; }
+    bool read_into(std::string&) { return false; }
+    bool write(std::string_view) { return false; }
+};
+
+#endif
@@ -0,0 +1,493 @@
+#pragma once
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <format>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Everything ChatServer asks of the operating system for its listeners,
+// clients and peers: the socket calls, with the same signatures and errno
+// conventions, plus a readiness set the event loop waits on. Handoff, TLS
+// and dialing peers still need real descriptors and only work over the
+// kernel transports.
+template<typename T>
+concept Transport = requires(T t, int fd, const sockaddr* addr, sockaddr* out_addr, socklen_t* out_len,
+                             const msghdr* msg, msghdr* out_msg, void* buffer, std::vector<int>& ready) {
+    { t.listen(addr, socklen_t{}, 0) } -> std::same_as<int>;
+    { t.accept(fd, out_addr, out_len) } -> std::same_as<int>;
+    { t.recv(fd, buffer, size_t{}, 0) } -> std::same_as<ssize_t>;
+    { t.send(fd, buffer, size_t{}, 0) } -> std::same_as<ssize_t>;
+    { t.sendmsg(fd, msg, 0) } -> std::same_as<ssize_t>;
+    { t.recvmsg(fd, out_msg, 0) } -> std::same_as<ssize_t>;
+    { t.setsockopt(fd, 0, 0, buffer, socklen_t{}) } -> std::same_as<int>;
+    { t.getsockopt(fd, 0, 0, buffer, out_len) } -> std::same_as<int>;
+    { t.shutdown(fd, 0) } -> std::same_as<int>;
+    { t.close(fd) } -> std::same_as<int>;
+    { t.can_watch(fd) } -> std::same_as<bool>;
+    { t.watch(fd) } -> std::same_as<int>;
+    t.unwatch(fd);
+    { t.wait(std::optional<std::chrono::microseconds>{}, ready) } -> std::same_as<int>;
+};
+
+// The socket calls of the kernel transports, which differ only in how
+// they wait.
+class KernelSockets {
+public:
+    // Creates, binds and listens on a stream socket; throws on failure.
+    int listen(const sockaddr* addr, socklen_t addrlen, int backlog) {
+        int fd = ::socket(addr->sa_family, SOCK_STREAM, 0);
+        if (fd < 0) {
+            throw std::runtime_error(std::format("socket failed: {}", strerror(errno)));
+        }
+
+        int opt = 1;
+        if (addr->sa_family != AF_UNIX && ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+            ::close(fd);
+            throw std::runtime_error(std::format("setsockopt failed: {}", strerror(errno)));
+        }
+        if (addr->sa_family == AF_INET6) {
+            int v6only = 0;
+            if (::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) < 0) {
+                ::close(fd);
+                throw std::runtime_error(std::format("setsockopt IPV6_V6ONLY failed: {}", strerror(errno)));
+            }
+        }
+        if (::bind(fd, addr, addrlen) < 0) {
+            ::close(fd);
+            throw std::runtime_error(std::format("bind failed: {}", strerror(errno)));
+        }
+        if (::listen(fd, backlog) < 0) {
+            ::close(fd);
+            throw std::runtime_error(std::format("listen failed: {}", strerror(errno)));
+        }
+        return fd;
+    }
+
+    int accept(int fd, sockaddr* addr, socklen_t* addrlen) { return ::accept(fd, addr, addrlen); }
+    ssize_t recv(int fd, void* buffer, size_t length, int flags) { return ::recv(fd, buffer, length, flags); }
+    ssize_t send(int fd, const void* data, size_t length, int flags) { return ::send(fd, data, length, flags); }
+    ssize_t sendmsg(int fd, const msghdr* msg, int flags) { return ::sendmsg(fd, msg, flags); }
+    ssize_t recvmsg(int fd, msghdr* msg, int flags) { return ::recvmsg(fd, msg, flags); }
+    int shutdown(int fd, int how) { return ::shutdown(fd, how); }
+    int close(int fd) { return ::close(fd); }
+
+    int setsockopt(int fd, int level, int name, const void* value, socklen_t length) {
+        return ::setsockopt(fd, level, name, value, length);
+    }
+
+    int getsockopt(int fd, int level, int name, void* value, socklen_t* length) {
+        return ::getsockopt(fd, level, name, value, length);
+    }
+};
+
+// Kernel sockets, waited on with select(). Unwatching the highest
+// descriptor walks the set down to the next one still watched.
+class SelectTransport : public KernelSockets {
+public:
+    SelectTransport() {
+        FD_ZERO(&watched);
+    }
+
+    // select() cannot watch descriptors at or beyond FD_SETSIZE.
+    bool can_watch(int fd) const { return fd >= 0 && fd < FD_SETSIZE; }
+
+    int watch(int fd) {
+        if (!can_watch(fd)) {
+            errno = EINVAL;
+            return -1;
+        }
+        FD_SET(fd, &watched);
+        max_fd = std::max(max_fd, fd);
+        return 0;
+    }
+
+    void unwatch(int fd) {
+        FD_CLR(fd, &watched);
+        while (max_fd >= 0 && !FD_ISSET(max_fd, &watched)) {
+            --max_fd;
+        }
+    }
+
+    // Fills ready with the readable descriptors; no timeout waits forever.
+    int wait(std::optional<std::chrono::microseconds> timeout, std::vector<int>& ready) {
+        ready.clear();
+        fd_set read_fds = watched;
+        timeval tv{};
+        if (timeout) {
+            tv.tv_sec = timeout->count() / 1'000'000;
+            tv.tv_usec = timeout->count() % 1'000'000;
+        }
+        int count = select(max_fd + 1, &read_fds, nullptr, nullptr, timeout ? &tv : nullptr);
+        for (int fd = 0; count > 0 && fd <= max_fd; ++fd) {
+            if (FD_ISSET(fd, &read_fds)) {
+                ready.push_back(fd);
+            }
+        }
+        return count;
+    }
+
+private:
+    fd_set watched;
+    int max_fd = -1;
+};
+
+// Kernel sockets, waited on with epoll. The kernel keeps the interest
+// list, so there is no descriptor limit, no highest descriptor to track,
+// and a wait costs the ready descriptors rather than all of them. Level-
+// triggered, like select().
+class EpollTransport : public KernelSockets {
+public:
+    EpollTransport() : epoll_fd(::epoll_create1(EPOLL_CLOEXEC)), events(INITIAL_EVENTS) {
+        if (epoll_fd < 0) {
+            throw std::runtime_error(std::format("epoll_create1 failed: {}", strerror(errno)));
+        }
+    }
+
+    EpollTransport(EpollTransport&& other) noexcept
+        : epoll_fd(std::exchange(other.epoll_fd, -1)), events(std::move(other.events)) {}
+
+    EpollTransport& operator=(EpollTransport&& other) noexcept {
+        std::swap(epoll_fd, other.epoll_fd);
+        std::swap(events, other.events);
+        return *this;
+    }
+
+    ~EpollTransport() {
+        if (epoll_fd >= 0) {
+            ::close(epoll_fd);
+        }
+    }
+
+    bool can_watch(int fd) const { return fd >= 0; }
+
+    // Fails like epoll_ctl, for example with ENOMEM or ENOSPC once
+    // max_user_watches is reached.
+    int watch(int fd) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        return ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    void unwatch(int fd) { ::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr); }
+
+    // Fills ready with the readable descriptors; no timeout waits forever.
+    int wait(std::optional<std::chrono::microseconds> timeout, std::vector<int>& ready) {
+        ready.clear();
+        int count = timeout ? wait_for(*timeout) : ::epoll_wait(epoll_fd, events.data(), capacity(), -1);
+        for (int i = 0; i < count; ++i) {
+            ready.push_back(events[static_cast<size_t>(i)].data.fd);
+        }
+        // A full batch means more may be waiting; take them all next time.
+        if (count == capacity()) {
+            events.resize(events.size() * 2);
+        }
+        return count;
+    }
+
+private:
+    static constexpr size_t INITIAL_EVENTS = 64;
+
+    int capacity() const { return static_cast<int>(events.size()); }
+
+    // epoll_pwait2 keeps the batch window's microseconds; kernels before
+    // 5.11 lack it and get epoll_wait, rounded up to the next millisecond.
+    int wait_for(std::chrono::microseconds timeout) {
+        timespec ts{};
+        ts.tv_sec = timeout.count() / 1'000'000;
+        ts.tv_nsec = timeout.count() % 1'000'000 * 1'000;
+        int count = ::epoll_pwait2(epoll_fd, events.data(), capacity(), &ts, nullptr);
+        if (count < 0 && errno == ENOSYS) {
+            auto ms = std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+            count = ::epoll_wait(epoll_fd, events.data(), capacity(), static_cast<int>(std::min<std::int64_t>(ms, INT_MAX)));
+        }
+        return count;
+    }
+
+    int epoll_fd;
+    std::vector<epoll_event> events;
+};
+
+// Descriptors handed out by MemoryTransport start here, well clear of any
+// real descriptor the server also holds (the mailbox's eventfd, say).
+constexpr int MEMORY_FD_BASE = 1 << 20;
+
+// Sockets that are only byte queues in this process, so the whole server
+// pipeline can be driven and measured without a system call on the data
+// path. Copies share the same state: the server owns one, and the driver
+// keeps another to connect clients, feed them input and read what the
+// server sent. wait() never blocks and readiness is level-triggered, like
+// select(). Only the byte counters may be touched from fan-out workers.
+class MemoryTransport {
+public:
+    MemoryTransport() : MemoryTransport(true) {}
+
+    // Without keep_output, sends are only counted, which keeps the driver
+    // out of the measurement.
+    explicit MemoryTransport(bool keep_output) : state(std::make_shared<State>()) {
+        state->keep_output = keep_output;
+    }
+
+    // Client side.
+
+    // Queues a connection on the listener bound to port; throws if none is.
+    int connect(std::uint16_t port) {
+        auto listener = std::ranges::find_if(state->listeners, [port](const auto& entry) { return entry.second.port == port; });
+        if (listener == state->listeners.end()) {
+            throw std::runtime_error(std::format("no memory listener on port {}", port));
+        }
+        int fd = state->next_fd++;
+        state->connections[fd];
+        listener->second.backlog.push_back(fd);
+        mark_readable(listener->first);
+        return fd;
+    }
+
+    void deliver(int fd, std::string_view bytes) {
+        auto it = state->connections.find(fd);
+        if (it == state->connections.end()) {
+            return;
+        }
+        it->second.input.append(bytes);
+        mark_readable(fd);
+    }
+
+    // The client closes its end; the server reads end-of-file.
+    void hang_up(int fd) {
+        auto it = state->connections.find(fd);
+        if (it == state->connections.end()) {
+            return;
+        }
+        it->second.hung_up = true;
+        mark_readable(fd);
+    }
+
+    // Everything the server sent on fd since the last call, including what
+    // it sent just before closing fd.
+    std::string take_output(int fd) {
+        if (auto it = state->connections.find(fd); it != state->connections.end()) {
+            return std::exchange(it->second.output, {});
+        }
+        if (auto node = state->unread.extract(fd)) {
+            return std::move(node.mapped());
+        }
+        return {};
+    }
+
+    // True once the server has closed fd.
+    bool closed(int fd) const { return !state->connections.contains(fd); }
+
+    std::uint64_t bytes_sent() const { return state->bytes_sent.load(std::memory_order_relaxed); }
+    std::uint64_t sends() const { return state->sends.load(std::memory_order_relaxed); }
+
+    // Server side.
+
+    int listen(const sockaddr* addr, socklen_t, int) {
+        std::uint16_t port = 0;
+        if (addr->sa_family == AF_INET) {
+            port = ntohs(reinterpret_cast<const sockaddr_in*>(addr)->sin_port);
+        } else if (addr->sa_family == AF_INET6) {
+            port = ntohs(reinterpret_cast<const sockaddr_in6*>(addr)->sin6_port);
+        }
+        int fd = state->next_fd++;
+        state->listeners[fd].port = port;
+        return fd;
+    }
+
+    int accept(int fd, sockaddr* addr, socklen_t* addrlen) {
+        auto it = state->listeners.find(fd);
+        if (it == state->listeners.end()) {
+            return fail(EBADF);
+        }
+        if (it->second.backlog.empty()) {
+            return fail(EAGAIN);
+        }
+        int client = it->second.backlog.front();
+        it->second.backlog.pop_front();
+        if (addr && addrlen) {
+            sockaddr_in loopback{};
+            loopback.sin_family = AF_INET;
+            loopback.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            loopback.sin_port = htons(static_cast<std::uint16_t>(client));
+            std::memcpy(addr, &loopback, std::min<size_t>(*addrlen, sizeof(loopback)));
+            *addrlen = sizeof(loopback);
+        }
+        return client;
+    }
+
+    ssize_t recv(int fd, void* buffer, size_t length, int) {
+        auto it = state->connections.find(fd);
+        if (it == state->connections.end()) {
+            return fail(EBADF);
+        }
+        Connection& connection = it->second;
+        size_t available = connection.input.size() - connection.consumed;
+        if (available == 0) {
+            return connection.hung_up ? 0 : fail(EAGAIN);
+        }
+        size_t bytes = std::min(length, available);
+        std::memcpy(buffer, connection.input.data() + connection.consumed, bytes);
+        connection.consumed += bytes;
+        if (connection.consumed == connection.input.size()) {
+            connection.input.clear();
+            connection.consumed = 0;
+        }
+        return static_cast<ssize_t>(bytes);
+    }
+
+    ssize_t send(int fd, const void* data, size_t length, int) {
+        iovec iov{const_cast<void*>(data), length};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        return sendmsg(fd, &msg, 0);
+    }
+
+    ssize_t sendmsg(int fd, const msghdr* msg, int) {
+        auto it = state->connections.find(fd);
+        if (it == state->connections.end()) {
+            return fail(EBADF);
+        }
+        if (it->second.hung_up) {
+            return fail(EPIPE);
+        }
+        size_t total = 0;
+        for (size_t i = 0; i < msg->msg_iovlen; ++i) {
+            if (state->keep_output) {
+                it->second.output.append(static_cast<const char*>(msg->msg_iov[i].iov_base), msg->msg_iov[i].iov_len);
+            }
+            total += msg->msg_iov[i].iov_len;
+        }
+        state->bytes_sent.fetch_add(total, std::memory_order_relaxed);
+        state->sends.fetch_add(1, std::memory_order_relaxed);
+        return static_cast<ssize_t>(total);
+    }
+
+    // Nothing is ever queued on the error queue.
+    ssize_t recvmsg(int, msghdr*, int) { return fail(EAGAIN); }
+
+    // Options are accepted and ignored, except SO_ZEROCOPY, which has no
+    // pages to pin here.
+    int setsockopt(int fd, int level, int name, const void*, socklen_t) {
+        if (!state->connections.contains(fd) && !state->listeners.contains(fd)) {
+            return fail(EBADF);
+        }
+        return level == SOL_SOCKET && name == SO_ZEROCOPY ? fail(EOPNOTSUPP) : 0;
+    }
+
+    int getsockopt(int, int, int, void*, socklen_t*) { return fail(ENOPROTOOPT); }
+
+    int shutdown(int fd, int) { return closed(fd) ? fail(EBADF) : 0; }
+
+    int close(int fd) {
+        unwatch(fd);
+        if (auto it = state->connections.find(fd); it != state->connections.end()) {
+            if (!it->second.output.empty()) {
+                state->unread[fd] = std::move(it->second.output);
+            }
+            state->connections.erase(it);
+            return 0;
+        }
+        return state->listeners.erase(fd) > 0 ? 0 : fail(EBADF);
+    }
+
+    bool can_watch(int) const { return true; }
+
+    int watch(int fd) {
+        state->watched.insert(fd);
+        mark_readable(fd);
+        return 0;
+    }
+
+    void unwatch(int fd) { state->watched.erase(fd); }
+
+    // Reports every watched descriptor with input, a pending connection or
+    // a hang-up; the timeout is ignored.
+    int wait(std::optional<std::chrono::microseconds>, std::vector<int>& ready) {
+        ready.clear();
+        std::erase_if(state->readable, [&](int fd) {
+            if (state->watched.contains(fd) && has_input(fd)) {
+                ready.push_back(fd);
+                return false;
+            }
+            state->queued.erase(fd);
+            return true;
+        });
+        return static_cast<int>(ready.size());
+    }
+
+private:
+    struct Connection {
+        std::string input;
+        size_t consumed = 0;
+        std::string output;
+        bool hung_up = false;
+    };
+
+    struct Listener {
+        std::uint16_t port = 0;
+        std::deque<int> backlog;
+    };
+
+    struct State {
+        int next_fd = MEMORY_FD_BASE;
+        bool keep_output = true;
+        std::unordered_map<int, Connection> connections;
+        std::unordered_map<int, Listener> listeners;
+        // Output of connections the server closed, until the client reads it.
+        std::unordered_map<int, std::string> unread;
+        std::unordered_set<int> watched;
+        // Descriptors that may be readable, in the order they became so.
+        std::vector<int> readable;
+        std::unordered_set<int> queued;
+        std::atomic<std::uint64_t> bytes_sent{0};
+        std::atomic<std::uint64_t> sends{0};
+    };
+
+    static int fail(int error) {
+        errno = error;
+        return -1;
+    }
+
+    bool has_input(int fd) const {
+        if (auto it = state->connections.find(fd); it != state->connections.end()) {
+            return it->second.hung_up || it->second.input.size() > it->second.consumed;
+        }
+        auto it = state->listeners.find(fd);
+        return it != state->listeners.end() && !it->second.backlog.empty();
+    }
+
+    void mark_readable(int fd) {
+        if (state->queued.insert(fd).second) {
+            state->readable.push_back(fd);
+        }
+    }
+
+    std::shared_ptr<State> state;
+};
+
+static_assert(Transport<SelectTransport>);
+static_assert(Transport<EpollTransport>);
+static_assert(Transport<MemoryTransport>);
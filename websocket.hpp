@@ -0,0 +1,256 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "protocol.hpp"
+
+// Just enough RFC 6455 for browsers to join the chat: the HTTP upgrade
+// handshake, masked client frames in, unmasked server frames out.
+
+constexpr std::string_view WEBSOCKET_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+// Upgrade requests larger than this are rejected rather than buffered.
+constexpr size_t MAX_UPGRADE_REQUEST = 8 * 1024;
+
+enum class WebSocketOpcode : std::uint8_t {
+    Continuation = 0x0,
+    Text = 0x1,
+    Binary = 0x2,
+    Close = 0x8,
+    Ping = 0x9,
+    Pong = 0xA,
+};
+
+struct WebSocketFrame {
+    WebSocketOpcode opcode;
+    bool fin;
+    std::string_view payload;
+};
+
+inline std::array<std::uint8_t, 20> sha1(std::string_view input) {
+    std::uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    auto rotl = [](std::uint32_t x, int n) { return (x << n) | (x >> (32 - n)); };
+
+    std::string message(input);
+    std::uint64_t bit_length = static_cast<std::uint64_t>(input.size()) * 8;
+    message += static_cast<char>(0x80);
+    while (message.size() % 64 != 56) message += '\0';
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        message += static_cast<char>(bit_length >> shift);
+    }
+
+    for (size_t block = 0; block < message.size(); block += 64) {
+        std::uint32_t w[80];
+        for (int i = 0; i < 16; ++i) {
+            std::uint32_t word;
+            std::memcpy(&word, message.data() + block + i * 4, 4);
+            w[i] = ntohl(word);
+        }
+        for (int i = 16; i < 80; ++i) {
+            w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+
+        std::uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; ++i) {
+            std::uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            std::uint32_t temp = rotl(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotl(b, 30);
+            b = a;
+            a = temp;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    std::array<std::uint8_t, 20> digest;
+    for (int i = 0; i < 5; ++i) {
+        std::uint32_t word = htonl(h[i]);
+        std::memcpy(digest.data() + i * 4, &word, 4);
+    }
+    return digest;
+}
+
+inline std::string base64_encode(std::span<const std::uint8_t> data) {
+    constexpr std::string_view alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    out.reserve((data.size() + 2) / 3 * 4);
+    for (size_t i = 0; i < data.size(); i += 3) {
+        std::uint32_t chunk = data[i] << 16;
+        if (i + 1 < data.size()) chunk |= data[i + 1] << 8;
+        if (i + 2 < data.size()) chunk |= data[i + 2];
+        out += alphabet[(chunk >> 18) & 0x3F];
+        out += alphabet[(chunk >> 12) & 0x3F];
+        out += i + 1 < data.size() ? alphabet[(chunk >> 6) & 0x3F] : '=';
+        out += i + 2 < data.size() ? alphabet[chunk & 0x3F] : '=';
+    }
+    return out;
+}
+
+inline bool iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        char x = a[i] >= 'A' && a[i] <= 'Z' ? a[i] + 32 : a[i];
+        char y = b[i] >= 'A' && b[i] <= 'Z' ? b[i] + 32 : b[i];
+        if (x != y) return false;
+    }
+    return true;
+}
+
+// Parses an HTTP upgrade request from the front of buffer. On Complete,
+// accept holds the Sec-WebSocket-Accept value and consumed the request size.
+inline ParseStatus parse_upgrade_request(std::string_view buffer, std::string& accept, size_t& consumed) {
+    size_t end = buffer.find("\r\n\r\n");
+    if (end == std::string_view::npos) {
+        return buffer.size() > MAX_UPGRADE_REQUEST ? ParseStatus::Invalid : ParseStatus::Incomplete;
+    }
+    if (!buffer.starts_with("GET ")) {
+        return ParseStatus::Invalid;
+    }
+
+    std::string_view headers = buffer.substr(0, end + 2);
+    std::string_view key;
+    for (size_t line = headers.find("\r\n") + 2; line < headers.size();) {
+        size_t next = headers.find("\r\n", line);
+        std::string_view header = headers.substr(line, next - line);
+        line = next + 2;
+
+        size_t colon = header.find(':');
+        if (colon == std::string_view::npos || !iequals(header.substr(0, colon), "Sec-WebSocket-Key")) {
+            continue;
+        }
+        key = header.substr(colon + 1);
+        while (key.starts_with(' ')) key.remove_prefix(1);
+        while (key.ends_with(' ')) key.remove_suffix(1);
+    }
+    if (key.empty()) {
+        return ParseStatus::Invalid;
+    }
+
+    std::string challenge(key);
+    challenge += WEBSOCKET_GUID;
+    accept = base64_encode(sha1(challenge));
+    consumed = end + 4;
+    return ParseStatus::Complete;
+}
+
+inline void append_upgrade_response(std::string& out, std::string_view accept) {
+    out += "HTTP/1.1 101 Switching Protocols\r\n"
+           "Upgrade: websocket\r\n"
+           "Connection: Upgrade\r\n"
+           "Sec-WebSocket-Accept: ";
+    out += accept;
+    out += "\r\n\r\n";
+}
+
+// XORs data with the repeating 4-byte mask. The bulk runs eight bytes at a
+// time against the mask doubled into a 64-bit word, which the compiler
+// widens further to SIMD registers; only the tail is done bytewise.
+inline void unmask(char* data, size_t length, const std::uint8_t (&mask)[4]) {
+    std::uint64_t wide;
+    std::memcpy(&wide, mask, 4);
+    std::memcpy(reinterpret_cast<char*>(&wide) + 4, mask, 4);
+
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        word ^= wide;
+        std::memcpy(data + i, &word, 8);
+    }
+    for (; i < length; ++i) {
+        data[i] ^= static_cast<char>(mask[i % 4]);
+    }
+}
+
+// Parses one client frame from the front of buffer and unmasks its payload
+// in place; on Complete, consumed is the frame's total size. Client frames
+// must be masked, and payloads are capped like binary frames.
+inline ParseStatus parse_websocket_frame(std::span<char> buffer, WebSocketFrame& frame, size_t& consumed) {
+    if (buffer.size() < 2) {
+        return ParseStatus::Incomplete;
+    }
+
+    auto byte0 = static_cast<std::uint8_t>(buffer[0]);
+    auto byte1 = static_cast<std::uint8_t>(buffer[1]);
+    if (!(byte1 & 0x80) || (byte0 & 0x70)) {
+        return ParseStatus::Invalid;
+    }
+
+    size_t header = 2;
+    std::uint64_t length = byte1 & 0x7F;
+    if (length == 126) {
+        if (buffer.size() < 4) return ParseStatus::Incomplete;
+        std::uint16_t net;
+        std::memcpy(&net, buffer.data() + 2, 2);
+        length = ntohs(net);
+        header = 4;
+    } else if (length == 127) {
+        if (buffer.size() < 10) return ParseStatus::Incomplete;
+        length = 0;
+        for (int i = 0; i < 8; ++i) {
+            length = (length << 8) | static_cast<std::uint8_t>(buffer[2 + i]);
+        }
+        header = 10;
+    }
+    if (length > MAX_FRAME_PAYLOAD) {
+        return ParseStatus::Invalid;
+    }
+    if (buffer.size() < header + 4 + length) {
+        return ParseStatus::Incomplete;
+    }
+
+    std::uint8_t mask[4];
+    std::memcpy(mask, buffer.data() + header, 4);
+    char* payload = buffer.data() + header + 4;
+    unmask(payload, length, mask);
+
+    frame = {static_cast<WebSocketOpcode>(byte0 & 0x0F), (byte0 & 0x80) != 0,
+             std::string_view{payload, static_cast<size_t>(length)}};
+    consumed = header + 4 + length;
+    return ParseStatus::Complete;
+}
+
+inline void append_websocket_frame_header(std::string& out, WebSocketOpcode opcode, size_t length) {
+    out += static_cast<char>(0x80 | static_cast<std::uint8_t>(opcode));
+    if (length < 126) {
+        out += static_cast<char>(length);
+    } else if (length <= 0xFFFF) {
+        out += static_cast<char>(126);
+        out += static_cast<char>(length >> 8);
+        out += static_cast<char>(length);
+    } else {
+        out += static_cast<char>(127);
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            out += static_cast<char>(static_cast<std::uint64_t>(length) >> shift);
+        }
+    }
+}
+
+inline void append_websocket_frame(std::string& out, WebSocketOpcode opcode, std::string_view payload) {
+    append_websocket_frame_header(out, opcode, payload.size());
+    out += payload;
+}